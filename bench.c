@@ -0,0 +1,299 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Throughput benchmark: drive the cache with synthetic access streams and
+ * report how fast it goes, for catching slowdowns in the access path.
+ *
+ * Every workload is generated up front from a fixed seed, so runs repeat
+ * exactly and only the accesses themselves are timed. Each one is replayed
+ * through a fresh cache of every geometry in turn, with cache actions
+ * turned off as replay -q does.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "cache.h"
+#include "memory.h"
+
+#define DEFAULT_ACCESSES 4000000
+#define DEFAULT_FOOTPRINT (1 << 20) // words
+#define DEFAULT_STRIDE 17           // words; odd, so it visits every word
+#define DEFAULT_ZIPF_EXPONENT 0.99
+#define CHASE_NODE_WORDS 4          // a pointer-chasing node, as in a linked list
+#define MAX_GEOMETRIES 16
+
+/* The access streams, in the order they're run */
+enum workload
+{
+    workloadSequential,
+    workloadStrided,
+    workloadRandom,
+    workloadChase,
+    workloadZipf,
+    NUM_WORKLOADS
+};
+
+static const char *const workloadNames[NUM_WORKLOADS] = {
+    "sequential", "strided", "random", "chase", "zipf"
+};
+
+static const char *const defaultGeometries[] = {
+    "4,64,4", "8,256,8", "16,1024,16", "8,4096,1", "8,1,512"
+};
+
+/* One access in a stream; stores carry no particular data */
+typedef struct benchAccess
+{
+    int addr;
+    int store;
+} benchAccess;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* splitmix64, so the streams are the same everywhere */
+static uint64_t nextRandom(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static int randomBelow(uint64_t *state, int limit)
+{
+    return (int)(nextRandom(state) % (uint64_t)limit);
+}
+
+static void usage(const char *program)
+{
+    printf("error: usage: %s [-n accesses] [-w footprint in words] [-s seed] "
+        "[-g <line size>,<sets>,<lines per set>]...\n\t[-k workload]...\n", program);
+    printf("\t-n\taccesses per workload (default %d)\n", DEFAULT_ACCESSES);
+    printf("\t-w\twords the workloads range over (default %d)\n", DEFAULT_FOOTPRINT);
+    printf("\t-g\ta cache geometry to run; the default is");
+    for (size_t i = 0; i < sizeof(defaultGeometries) / sizeof(defaultGeometries[0]); ++i) {
+        printf(" %s", defaultGeometries[i]);
+    }
+    printf("\n\t-k\ta workload to run: sequential, strided, random, chase or zipf; "
+        "the default is all\n");
+    exit(1);
+}
+
+/*
+ * Fill accesses with numAccesses of workload over footprint words. Every
+ * fourth access is a store, except when chasing pointers.
+ */
+static void generate(enum workload workload, benchAccess *accesses, int numAccesses,
+    int footprint, uint64_t seed)
+{
+    uint64_t state = seed;
+    int *next = NULL;
+    double *cdf = NULL;
+    int numNodes = footprint / CHASE_NODE_WORDS;
+    if (workload == workloadChase) {
+        // one random cycle through every node (Sattolo's algorithm), so the
+        // chase never settles into a short loop
+        next = malloc(numNodes * sizeof(int));
+        if (!next) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        for (int i = 0; i < numNodes; ++i) {
+            next[i] = i;
+        }
+        for (int i = numNodes - 1; i > 0; --i) {
+            int j = randomBelow(&state, i);
+            int swap = next[i];
+            next[i] = next[j];
+            next[j] = swap;
+        }
+    } else if (workload == workloadZipf) {
+        // word i is drawn with probability proportional to 1 / (i + 1)^s,
+        // with the popular words scattered rather than all at the bottom
+        cdf = malloc(footprint * sizeof(double));
+        if (!cdf) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        double total = 0;
+        for (int i = 0; i < footprint; ++i) {
+            total += pow(i + 1, -DEFAULT_ZIPF_EXPONENT);
+            cdf[i] = total;
+        }
+    }
+    int node = 0;
+    for (int i = 0; i < numAccesses; ++i) {
+        benchAccess *access = &accesses[i];
+        access->store = i % 4 == 3;
+        switch (workload) {
+        case workloadSequential:
+            access->addr = i % footprint;
+            break;
+        case workloadStrided:
+            access->addr = (int)((long long)i * DEFAULT_STRIDE % footprint);
+            break;
+        case workloadRandom:
+            access->addr = randomBelow(&state, footprint);
+            break;
+        case workloadChase:
+            access->addr = node * CHASE_NODE_WORDS;
+            access->store = 0;
+            node = next[node];
+            break;
+        default: {
+            double target = (double)(nextRandom(&state) >> 11) / (1ull << 53) * cdf[footprint - 1];
+            int low = 0;
+            int high = footprint - 1;
+            while (low < high) {
+                int middle = low + (high - low) / 2;
+                if (cdf[middle] < target) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            // a fixed odd multiplier spreads the ranks over the footprint
+            access->addr = (int)((long long)low * 2654435761u % footprint);
+            break;
+        }
+        }
+    }
+    free(next);
+    free(cdf);
+}
+
+/* Peak resident set size so far, in kilobytes */
+static long peakRssKb(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes there
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    int numAccesses = DEFAULT_ACCESSES;
+    int footprint = DEFAULT_FOOTPRINT;
+    uint64_t seed = 1;
+    const char *geometryNames[MAX_GEOMETRIES];
+    cacheConfig geometries[MAX_GEOMETRIES];
+    int numGeometries = 0;
+    int selected[NUM_WORKLOADS] = { 0 };
+    int anySelected = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            numAccesses = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            footprint = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            if (numGeometries == MAX_GEOMETRIES
+                || !cache_config_parse(argv[++i], &geometries[numGeometries])) {
+                usage(argv[0]);
+            }
+            geometryNames[numGeometries++] = argv[i];
+        } else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+            int workload = 0;
+            ++i;
+            while (workload < NUM_WORKLOADS && strcmp(argv[i], workloadNames[workload])) {
+                ++workload;
+            }
+            if (workload == NUM_WORKLOADS) {
+                printf("error: unknown workload %s\n", argv[i]);
+                exit(1);
+            }
+            selected[workload] = 1;
+            anySelected = 1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (numAccesses < 1 || footprint < CHASE_NODE_WORDS) {
+        usage(argv[0]);
+    }
+    if (!numGeometries) {
+        for (size_t i = 0; i < sizeof(defaultGeometries) / sizeof(defaultGeometries[0]); ++i) {
+            cache_config_parse(defaultGeometries[i], &geometries[numGeometries]);
+            geometryNames[numGeometries++] = defaultGeometries[i];
+        }
+    }
+    for (int i = 0; i < numGeometries; ++i) {
+        const char *error = cache_config_error(&geometries[i]);
+        if (error) {
+            printf("error: %s: %s\n", geometryNames[i], error);
+            exit(1);
+        }
+    }
+
+    benchAccess *accesses = malloc((size_t)numAccesses * sizeof(benchAccess));
+    if (!accesses) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    printf("%d accesses per run over %d words, seed %llu\n", numAccesses, footprint,
+        (unsigned long long)seed);
+    printf("%-12s %-12s %12s %10s %10s\n", "workload", "geometry", "M accesses/s",
+        "ns/access", "miss rate");
+    double totalSeconds = 0;
+    long long totalAccesses = 0;
+    cacheProfileFile *profile = cache_profile_open(NULL);
+    for (int workload = 0; workload < NUM_WORKLOADS; ++workload) {
+        if (anySelected && !selected[workload]) {
+            continue;
+        }
+        generate(workload, accesses, numAccesses, footprint, seed);
+        for (int g = 0; g < numGeometries; ++g) {
+            // memory rounded up to whole lines, as replay does
+            int blockSize = geometries[g].blockSize;
+            flatMemory *memory = flat_memory_create((footprint / blockSize + 1) * blockSize);
+            cacheMemory memoryInterface = flat_memory_interface(memory);
+            cacheStruct *cache = cache_handle_create(&geometries[g], &memoryInterface);
+            cache_handle_set_output(cache, outputNone);
+
+            double start = now();
+            for (int i = 0; i < numAccesses; ++i) {
+                cache_handle_access(cache, accesses[i].addr, accesses[i].store, i);
+            }
+            double elapsed = now() - start;
+
+            cacheStats stats;
+            cache_handle_stats(cache, &stats);
+            printf("%-12s %-12s %12.1f %10.2f %9.2f%%\n", workloadNames[workload],
+                geometryNames[g], elapsed > 0 ? numAccesses / elapsed / 1e6 : 0.0,
+                elapsed * 1e9 / numAccesses, 100.0 * stats.misses / numAccesses);
+            totalSeconds += elapsed;
+            totalAccesses += numAccesses;
+            char name[64];
+            snprintf(name, sizeof(name), "%s %s", workloadNames[workload], geometryNames[g]);
+            cache_handle_profile_write(profile, cache, name);
+            cache_handle_destroy(cache);
+            flat_memory_destroy(memory);
+        }
+    }
+    cache_profile_close(profile);
+    printf("overall %.1f M accesses/s, %.2f ns/access, peak RSS %ld KB\n",
+        totalSeconds > 0 ? totalAccesses / totalSeconds / 1e6 : 0.0,
+        totalAccesses ? totalSeconds * 1e9 / totalAccesses : 0.0, peakRssKb());
+    free(accesses);
+    return 0;
+}
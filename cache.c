@@ -4,13 +4,54 @@
  * Instructions are found in the project spec.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "cache.h"
+#include "events.h"
+#include "trace.h"
+
+// Event logs are written by a background thread where there are pthreads
+#if !defined(_WIN32) && !defined(CACHE_NO_THREADS)
+#define CACHE_THREADS
+#include <pthread.h>
+#endif
+
+// Profiling timers read the time stamp counter where there is one
+#ifdef CACHE_PROFILE
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PROFILE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_TSC
+#else
+#include <time.h>
+#endif
+#endif
+
+// Checkpoints are restored by mapping them in where there's mmap
+#if !defined(_WIN32)
+#define CACHE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-#define MAX_CACHE_SIZE 256
-#define MAX_BLOCK_SIZE 256
+// Line storage is sized to the configuration; this only keeps sizes in range
+// of an int. Larger caches couldn't be filled by a 28-bit trace anyway.
+#define MAX_CACHE_WORDS (1 << 28)
 
 // **Note** this is a preprocessor macro. This is not the same as a function.
 // Powers of 2 have exactly one 1 and the rest 0's, and 0 isn't a power of 2.
@@ -25,187 +66,4433 @@
  * If write flag is 1, mem_access does: state.mem[addr] = write_data.
  * The return of mem_access is state.mem[addr].
  */
-extern int mem_access(int addr, int write_flag, int write_data);
+extern int mem_access(int addr, int write_flag, int write_data);
+
+/*
+ * Returns the number of times mem_access has been called.
+ */
+extern int get_num_mem_accesses(void);
+
+// enum actionType, which printAction uses, is in cache.h so decode can share it
+
+// The words mem_access can reach: LC-2K addresses are 16 bits
+#define LC2K_MEMORY_WORDS 65536
+
+/*
+ * Trace capture. When on, every access to a cache and every mem_access call
+ * it makes is appended to a binary trace (see trace.h) that replay can run
+ * against other cache configurations.
+ */
+#define CAPTURE_BUFFER_RECORDS 4096
+
+typedef struct captureState
+{
+    FILE *file;
+    traceHeader header;
+    int count;
+    traceRecord buffer[CAPTURE_BUFFER_RECORDS];
+} captureState;
+
+/*
+ * Binary event log. Instead of printing, each cache action is appended as
+ * an eventRecord (see events.h) to one of two large buffers. When a buffer
+ * fills, it is handed to a writer thread and the cache carries on with the
+ * other one, so the simulation doesn't wait on I/O unless the disk can't
+ * keep up.
+ */
+#define EVENT_BUFFER_RECORDS (1 << 18)
+
+typedef struct eventLog
+{
+    FILE *file;
+    eventRecord *buffers[2];
+    int active; // the buffer being filled
+    int count;  // records in the active buffer
+    long long logged; // records since the log started
+#ifdef CACHE_THREADS
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    eventRecord *pending; // handed to the writer; NULL once written
+    int pendingCount;
+    bool done;            // no more buffers are coming
+#endif
+} eventLog;
+
+/*
+ * Miss classification. A shadow fully associative LRU cache with as many
+ * lines as the real one sees every access. A real miss is compulsory if the
+ * block was never seen before, capacity if the shadow misses too, and
+ * conflict if the shadow hits, i.e. more associativity would have helped.
+ */
+typedef struct shadowCache
+{
+    int numLines;  // lines in the real cache
+    int numFilled;
+    int *blocks;   // per shadow line: the block's first address
+    int *more;     // per shadow line: the next more recently used line
+    int *less;     // per shadow line: the next less recently used line
+    int mru;
+    int lru;
+    // open addressing table of every block seen; the value is the block's
+    // shadow line, or -1 once it has been evicted
+    int *keys;     // -1 if the slot is empty
+    int *values;
+    int tableBits;
+    int numKeys;
+} shadowCache;
+
+/* What the shadow cache made of an access */
+enum shadowResult
+{
+    shadowFirst, // never seen before
+    shadowMiss,
+    shadowHit
+};
+
+/*
+ * Prefetcher state. The stride prefetcher keeps a reference prediction
+ * table indexed by PC. The stream prefetcher keeps a few FIFO buffers of
+ * the lines after a miss, outside the cache, which later misses take from.
+ */
+#define DEFAULT_PREFETCH_DEGREE 4
+#define MAX_PREFETCH_DEGREE 64
+#define STRIDE_TABLE_SIZE 64
+#define STRIDE_CONFIDENT 2 // repeats of a stride before prefetching along it
+#define STRIDE_MAX_CONFIDENCE 3
+#define NUM_STREAM_BUFFERS 4
+
+typedef struct strideEntry
+{
+    int pc;         // -1 if unused
+    int lastAddr;
+    int stride;
+    int confidence; // times in a row the stride repeated
+} strideEntry;
+
+typedef struct streamBuffer
+{
+    int *blocks;          // each line's first address, or -1; oldest at head
+    int *data;            // blockSize words per line
+    unsigned char *dirty; // only an exclusive level below hands over dirty lines
+    int head;
+    int count;
+    int next;             // the next line to fetch into it
+    unsigned int lastUse; // to replace the least recently used buffer
+} streamBuffer;
+
+/*
+ * Write buffer. Stores that go below the cache (write-through, or a store
+ * miss without write-allocate) wait here, one entry per line, so later
+ * stores to the same line merge into one write. Entries drain oldest first
+ * when the buffer is full, and before the cache reads a line they cover.
+ */
+#define MAX_WRITE_BUFFER_ENTRIES 64
+
+// Victim caches are searched in full on every miss, so they stay small
+#define MAX_VICTIM_ENTRIES 64
+
+typedef struct writeBuffer
+{
+    int *lines;           // each entry's line address, oldest first
+    int *data;            // blockSize words per entry
+    unsigned char *valid; // which of an entry's words hold stores
+    int count;
+    int capacity;
+} writeBuffer;
+
+/*
+ * Timing. A cache that models time keeps a clock for the processor using
+ * it and times each access from issue to completion: a hit takes the hit
+ * latency, and a miss that fetches a line waits the miss penalty and then
+ * for the line to cross the memory bus, one transfer at a time. A blocking
+ * cache holds the processor until each access completes. A non-blocking
+ * one only holds it for the hit latency (except on instruction fetches,
+ * which it can't run ahead of), and tracks fills in flight in
+ * MSHRs (miss status holding registers): a later access to a line being
+ * filled merges into its MSHR instead of fetching it again, and a miss
+ * with every MSHR busy waits for the first one to free up.
+ */
+#define DEFAULT_HIT_LATENCY 1
+#define DEFAULT_MISS_PENALTY 100
+#define MAX_MSHRS 64
+
+typedef struct timingState
+{
+    int hitLatency;
+    int missPenalty;
+    int bandwidth;          // words per cycle
+    bool blocking;
+    int numMshrs;           // a blocking cache has one, for the fill it waits on
+    long long now;          // when the processor issues its next access
+    long long busFree;      // when the memory bus is next idle
+    int *mshrLines;         // the line each MSHR is filling
+    long long *mshrReady;   // when that fill completes; free once it's past
+} timingState;
+
+/*
+ * Reuse profiling. An access's reuse distance is the number of distinct
+ * lines (or words) used since the last use of its own; a fully associative
+ * LRU cache of n lines hits exactly the accesses at a distance below n, so
+ * the histogram of distances sizes a cache for the trace. Each tracker
+ * marks the time of every address's last use in a Fenwick tree; the
+ * distance is then the number of marks after the address's own, found in
+ * O(log n). Times are renumbered when they run out, which keeps the tree
+ * in proportion to the addresses seen rather than to the trace. The same
+ * table counts the distinct addresses in each window of accesses: the
+ * working set over time.
+ */
+#define REUSE_BUCKETS 32 // distance 0, then 1, 2-3, 4-7 and so on
+#define MIN_REUSE_TIMES 1024
+
+typedef struct reuseTracker
+{
+    // open addressing table of every address seen
+    int *keys;      // -1 if the slot is empty
+    int *times;     // when the address was last used
+    int *windows;   // the window it was last used in
+    int tableBits;
+    int numKeys;
+    // Fenwick tree over times 1 to capacity, with the times that are some
+    // address's last use marked; markKeys says whose, or -1
+    int *tree;
+    int *markKeys;
+    int capacity;
+    int now;        // the latest time handed out
+    long long firstUses;
+    long long histogram[REUSE_BUCKETS];
+    int windowKeys;   // addresses used so far in the current window
+    int *workingSets; // addresses used in each finished window
+    int numWindows;
+    int windowCapacity;
+} reuseTracker;
+
+typedef struct reuseProfile
+{
+    int window;        // accesses per working set window
+    int windowAccesses; // accesses so far in the current one
+    reuseTracker lines;
+    reuseTracker words;
+} reuseProfile;
+
+/*
+ * Set sampling. A cache that samples sets simulates only every
+ * sampleInterval-th set, counting each one's accesses, misses and
+ * writebacks. Sets are chosen by index, so each is a random cluster of
+ * the trace's blocks; the ratio of misses to accesses over the sampled
+ * sets estimates the whole cache's miss rate, and how much it varies from
+ * set to set gives the confidence interval around it.
+ */
+// z for a 95% confidence interval
+#define SAMPLE_CONFIDENCE_Z 1.96
+
+/*
+ * Checkpoint file. A checkpointHeader, padded out to CHECKPOINT_ARENA_OFFSET
+ * bytes, then the cache's arena exactly as it is in memory: tags,
+ * replacement state, data, dirty bits and so on (see cache_handle_create).
+ * The arena starts on a page boundary, so a restore can map the file in
+ * copy-on-write and use it where it is.
+ */
+#define CHECKPOINT_MAGIC "C370CKP"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_ARENA_OFFSET 4096
+
+typedef struct checkpointHeader
+{
+    char magic[8];        // CHECKPOINT_MAGIC, NUL terminated
+    uint32_t version;     // CHECKPOINT_VERSION of the writer
+    int32_t blockSize;
+    int32_t numSets;
+    int32_t blocksPerSet;
+    int32_t policy;       // enum replacementPolicy
+    uint32_t randomState;
+    uint32_t holes;
+    uint32_t statsSize;   // sizeof(cacheStats)
+    uint64_t arenaSize;   // bytes
+    int64_t memoryAccesses; // main memory's count of accesses so far
+    cacheStats stats;
+} checkpointHeader;
+
+/*
+ * Profiling, compiled in with -DCACHE_PROFILE. Each cache then times the
+ * parts of the access path below, counts how many tags each lookup had to
+ * compare and what happened in each set. printStats writes it all out as
+ * JSON, and front-ends with caches of their own do so with
+ * cache_handle_profile_write. Without CACHE_PROFILE the PROFILE_ macros
+ * compile to nothing.
+ */
+#ifdef CACHE_PROFILE
+enum profileTimer
+{
+    profileAccess,     // cache_handle_access_kind, all of it
+    profileWriteBlock, // writeBlockToCache
+    profileLruBlock,   // lruBlock
+    profileUpdateLRU,  // updateLRU
+    NUM_PROFILE_TIMERS
+};
+
+static const char *const profileTimerNames[NUM_PROFILE_TIMERS] = {
+    "access", "writeBlockToCache", "lruBlock", "updateLRU"
+};
+
+typedef struct profileState
+{
+    long long calls[NUM_PROFILE_TIMERS];
+    long long ticks[NUM_PROFILE_TIMERS]; // TSC cycles, or ns without a TSC
+    long long *scanLengths;  // lookups that compared i + 1 tags; blocksPerSet of them
+    long long *setHits;      // numSets of each
+    long long *setMisses;
+    long long *setEvictions;
+} profileState;
+
+#define PROFILE_BEGIN(start) long long start = profileClock()
+#define PROFILE_END(cache, timer, start) profileAdd((cache)->profile, timer, start)
+#define PROFILE_LOOKUP(cache, set, way, ways) profileLookup((cache)->profile, set, way, ways)
+#define PROFILE_EVICT(cache, set) (++(cache)->profile->setEvictions[set])
+#else
+#define PROFILE_BEGIN(start)
+#define PROFILE_END(cache, timer, start)
+#define PROFILE_LOOKUP(cache, set, way, ways)
+#define PROFILE_EVICT(cache, set)
+#endif
+
+/*
+ * One cache. Everything an instance needs lives here, so separate instances
+ * can run on separate threads without sharing anything.
+ */
+struct cacheStruct
+{
+    // Line state is kept as separate arrays rather than an array of line
+    // structs, so the tags of a set are contiguous and can be compared
+    // together. Line i of set s is entry s * blocksPerSet + i of each.
+    int *tags;            // -1 if the line is invalid
+    int *lineRepl;        // replacement policy state; see replacementOps
+    int *lineRepl2;
+    int *setRepl;         // two per set
+    unsigned char *dirty;
+    unsigned char *prefetched; // the prefetcher filled the line; not used yet
+    // Other cores' caches may hold the line too. With the tag and dirty
+    // flag this is a coherent cache's MESI state: a valid line is Modified
+    // if dirty, else Shared if shared, else Exclusive. See cacheMulticore.
+    unsigned char *shared;
+    int *data;            // blockSize words per line
+    int blockSize;
+    int numSets;
+    int blocksPerSet;
+    // my added variables (if needed)
+    cacheStats stats;
+    enum outputMode outputMode; // where cache actions go
+    cacheMemory memory;         // where misses and writebacks go
+    captureState *capture;      // NULL unless capturing
+    eventLog *events;           // NULL unless logging to a file
+    shadowCache *shadow;        // NULL unless classifying misses
+    reuseProfile *reuse;        // NULL unless profiling reuse
+    // In an inclusive hierarchy, called before a valid line is evicted so
+    // the levels above can give up their copies; see evictLine
+    int (*evictHook)(void *context, cacheStruct *cache, int addr, int *data, int size);
+    void *evictContext;
+    bool holes;                 // lines have been invalidated, not just replaced
+    // the other half of a split L1, whose copies every fill must respect;
+    // with moveFromSibling (exclusive levels) even clean copies move over
+    cacheStruct *sibling;
+    bool moveFromSibling;
+    // prefetching; see prefetchAfter
+    enum prefetcher prefetcher;
+    int prefetchDegree;
+    int lastFetch;              // the stride prefetcher's PC
+    strideEntry *strides;       // for prefetchStride
+    streamBuffer *streams;      // for prefetchStream
+    unsigned int streamClock;
+    // what the last miss left for prefetchAfter: a stream buffer to top up,
+    // or a line to start a new stream after (-1 if neither)
+    streamBuffer *refill;
+    int streamMiss;
+    enum writePolicy writePolicy;
+    bool writeAllocate;
+    writeBuffer *writeBuffer;   // NULL without one
+    // A small fully associative cache of the lines this one evicts, linked
+    // below it as an exclusive level; NULL without one
+    cacheStruct *victim;
+    int *victimLine;            // a line on its way out of the victim cache
+    timingState *timing;        // NULL unless modeling time
+    int sampleInterval;         // 1 unless sampling sets
+    sampleCounts *samples;      // one per sampled set; NULL unless sampling
+    bool warming;               // see cache_handle_set_warming
+#ifdef CACHE_PROFILE
+    profileState *profile;
+#endif
+    // the restored checkpoint the arena lives in; NULL if the arena was
+    // allocated (see cache_handle_restore)
+    void *mapping;
+    size_t mappingSize;
+    const struct replacementOps *policy;
+    unsigned int randomState;   // for policies that need random numbers
+    // address decomposition, worked out once when the cache is created
+    bool powerOf2;  // blockSize and numSets are both powers of 2
+    int blockShift; // log2(blockSize)
+    int blockMask;  // blockSize - 1
+    int setMask;    // numSets - 1
+    int tagShift;   // log2(blockSize) + log2(numSets)
+};
+
+/* Global Cache variable, used by the LC-2K simulator's entry points */
+static cacheStruct *globalCache = NULL;
+/* The hierarchy globalCache is the data L1 of, if there is one */
+static cacheHierarchy *globalHierarchy = NULL;
+
+void printAction(int, int, enum actionType);
+void printCache(void);
+
+/*
+ * Report a cache action according to the cache's output mode.
+ * All cache actions go through here instead of calling printAction directly.
+ */
+static void flushEvents(eventLog *events);
+
+static void logAction(const cacheStruct *cache, int address, int size, enum actionType type)
+{
+    if (cache->outputMode == outputText) {
+        printAction(address, size, type);
+    } else if (cache->outputMode == outputBinary && cache->events) {
+        eventLog *events = cache->events;
+        events->buffers[events->active][events->count++] = makeEventRecord(address, size, type);
+        ++events->logged;
+        if (events->count == EVENT_BUFFER_RECORDS) {
+            flushEvents(events);
+        }
+    }
+}
+
+#ifdef CACHE_THREADS
+static void *eventWriter(void *arg)
+{
+    eventLog *events = arg;
+    pthread_mutex_lock(&events->lock);
+    for (;;) {
+        while (!events->pending && !events->done) {
+            pthread_cond_wait(&events->changed, &events->lock);
+        }
+        if (!events->pending) {
+            break;
+        }
+        eventRecord *buffer = events->pending;
+        int count = events->pendingCount;
+        // write without holding the lock so the cache can keep filling
+        pthread_mutex_unlock(&events->lock);
+        fwrite(buffer, sizeof(eventRecord), count, events->file);
+        pthread_mutex_lock(&events->lock);
+        events->pending = NULL;
+        pthread_cond_broadcast(&events->changed);
+    }
+    pthread_mutex_unlock(&events->lock);
+    return NULL;
+}
+#endif
+
+/* Hand the active buffer to the writer and switch to the other one */
+static void flushEvents(eventLog *events)
+{
+    if (events->count == 0) {
+        return;
+    }
+#ifdef CACHE_THREADS
+    pthread_mutex_lock(&events->lock);
+    // the other buffer may still be being written
+    while (events->pending) {
+        pthread_cond_wait(&events->changed, &events->lock);
+    }
+    events->pending = events->buffers[events->active];
+    events->pendingCount = events->count;
+    pthread_cond_broadcast(&events->changed);
+    pthread_mutex_unlock(&events->lock);
+#else
+    fwrite(events->buffers[events->active], sizeof(eventRecord), events->count, events->file);
+#endif
+    events->active = !events->active;
+    events->count = 0;
+}
+
+/*
+ * Log this cache's actions to path in binary instead of printing them.
+ * decode turns the file back into printAction's text. A victim cache
+ * logs its own actions to <path>.victim.
+ */
+void cache_handle_log_start(cacheStruct *cache, const char *path)
+{
+    cache_handle_log_stop(cache);
+    eventLog *events = malloc(sizeof(eventLog));
+    if (events) {
+        events->buffers[0] = malloc(EVENT_BUFFER_RECORDS * sizeof(eventRecord));
+        events->buffers[1] = malloc(EVENT_BUFFER_RECORDS * sizeof(eventRecord));
+    }
+    if (!events || !events->buffers[0] || !events->buffers[1]) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    events->file = fopen(path, "wb");
+    if (!events->file) {
+        printf("error: can't open event log %s for writing\n", path);
+        exit(1);
+    }
+    eventHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EVENT_MAGIC, sizeof(EVENT_MAGIC));
+    header.version = EVENT_VERSION;
+    header.recordSize = sizeof(eventRecord);
+    fwrite(&header, sizeof(header), 1, events->file);
+    events->active = 0;
+    events->count = 0;
+    events->logged = 0;
+#ifdef CACHE_THREADS
+    pthread_mutex_init(&events->lock, NULL);
+    pthread_cond_init(&events->changed, NULL);
+    events->pending = NULL;
+    events->pendingCount = 0;
+    events->done = false;
+    if (pthread_create(&events->writer, NULL, eventWriter, events)) {
+        printf("error: can't start the event log writer\n");
+        exit(1);
+    }
+#endif
+    cache->events = events;
+    cache->outputMode = outputBinary;
+    if (cache->victim) {
+        char *victimPath = malloc(strlen(path) + sizeof(".victim"));
+        if (!victimPath) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        sprintf(victimPath, "%s.victim", path);
+        cache_handle_log_start(cache->victim, victimPath);
+        free(victimPath);
+    }
+}
+
+/* How many actions the cache has logged since its log started */
+long long cache_handle_log_count(const cacheStruct *cache)
+{
+    return cache->events ? cache->events->logged : 0;
+}
+
+/* Write out everything logged so far and close the log */
+void cache_handle_log_stop(cacheStruct *cache)
+{
+    if (cache->victim) {
+        cache_handle_log_stop(cache->victim);
+    }
+    eventLog *events = cache->events;
+    if (!events) {
+        return;
+    }
+    flushEvents(events);
+#ifdef CACHE_THREADS
+    pthread_mutex_lock(&events->lock);
+    events->done = true;
+    pthread_cond_broadcast(&events->changed);
+    pthread_mutex_unlock(&events->lock);
+    pthread_join(events->writer, NULL);
+    pthread_mutex_destroy(&events->lock);
+    pthread_cond_destroy(&events->changed);
+#endif
+    fclose(events->file);
+    free(events->buffers[0]);
+    free(events->buffers[1]);
+    free(events);
+    cache->events = NULL;
+    if (cache->outputMode == outputBinary) {
+        cache->outputMode = outputNone;
+    }
+}
+
+static void flushCapture(captureState *capture)
+{
+    if (capture->count > 0) {
+        fwrite(capture->buffer, sizeof(traceRecord), capture->count, capture->file);
+        capture->count = 0;
+    }
+}
+
+static void captureRecord(captureState *capture, enum traceKind kind, int addr, int data)
+{
+    if (capture->count == CAPTURE_BUFFER_RECORDS) {
+        flushCapture(capture);
+    }
+    capture->buffer[capture->count++] = makeTraceRecord(kind, addr, data);
+    ++capture->header.numRecords;
+    if ((uint32_t)addr > capture->header.maxAddr) {
+        capture->header.maxAddr = (uint32_t)addr;
+    }
+}
+
+/*
+ * Start recording to path. The header is rewritten with the final record
+ * count by cache_handle_capture_stop.
+ */
+void cache_handle_capture_start(cacheStruct *cache, const char *path)
+{
+    cache_handle_capture_stop(cache);
+    captureState *capture = malloc(sizeof(captureState));
+    if (!capture) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    capture->file = fopen(path, "wb");
+    if (!capture->file) {
+        printf("error: can't open trace file %s for writing\n", path);
+        exit(1);
+    }
+    memset(&capture->header, 0, sizeof(capture->header));
+    memcpy(capture->header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    capture->header.version = TRACE_VERSION;
+    capture->header.recordSize = sizeof(traceRecord);
+    fwrite(&capture->header, sizeof(capture->header), 1, capture->file);
+    capture->count = 0;
+    cache->capture = capture;
+}
+
+void cache_handle_capture_stop(cacheStruct *cache)
+{
+    captureState *capture = cache->capture;
+    if (!capture) {
+        return;
+    }
+    flushCapture(capture);
+    fseek(capture->file, 0, SEEK_SET);
+    fwrite(&capture->header, sizeof(capture->header), 1, capture->file);
+    fclose(capture->file);
+    free(capture);
+    cache->capture = NULL;
+}
+
+static writeBuffer *writeBufferCreate(int blockSize, int capacity)
+{
+    writeBuffer *buffer = malloc(sizeof(writeBuffer));
+    if (buffer) {
+        buffer->lines = malloc((size_t)capacity * (1 + blockSize) * sizeof(int)
+            + (size_t)capacity * blockSize);
+    }
+    if (!buffer || !buffer->lines) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    buffer->data = buffer->lines + capacity;
+    buffer->valid = (unsigned char *)(buffer->data + (size_t)capacity * blockSize);
+    buffer->count = 0;
+    buffer->capacity = capacity;
+    return buffer;
+}
+
+static void writeBufferDestroy(writeBuffer *buffer)
+{
+    if (buffer) {
+        free(buffer->lines);
+        free(buffer);
+    }
+}
+
+static timingState *timingCreate(const cacheConfig *config)
+{
+    timingState *timing = malloc(sizeof(timingState));
+    if (timing) {
+        timing->blocking = config->mshrs == 0;
+        timing->numMshrs = timing->blocking ? 1 : config->mshrs;
+        timing->mshrReady = malloc((size_t)timing->numMshrs * (sizeof(long long) + sizeof(int)));
+    }
+    if (!timing || !timing->mshrReady) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    timing->hitLatency = config->hitLatency;
+    timing->missPenalty = config->missPenalty;
+    timing->bandwidth = config->memoryBandwidth;
+    timing->now = 0;
+    timing->busFree = 0;
+    timing->mshrLines = (int *)(timing->mshrReady + timing->numMshrs);
+    for (int i = 0; i < timing->numMshrs; ++i) {
+        timing->mshrLines[i] = -1;
+        timing->mshrReady[i] = 0;
+    }
+    return timing;
+}
+
+static void timingDestroy(timingState *timing)
+{
+    if (timing) {
+        free(timing->mshrReady);
+        free(timing);
+    }
+}
+
+/* When everything issued so far is done, fills and writebacks included */
+static long long timingEnd(const timingState *timing)
+{
+    long long end = timing->now > timing->busFree ? timing->now : timing->busFree;
+    for (int i = 0; i < timing->numMshrs; ++i) {
+        if (timing->mshrReady[i] > end) {
+            end = timing->mshrReady[i];
+        }
+    }
+    return end;
+}
+
+static streamBuffer *streamCreate(int blockSize, int depth)
+{
+    streamBuffer *streams = malloc(NUM_STREAM_BUFFERS * sizeof(streamBuffer));
+    if (!streams) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < NUM_STREAM_BUFFERS; ++i) {
+        streamBuffer *stream = &streams[i];
+        stream->blocks = malloc((size_t)depth * (1 + blockSize) * sizeof(int) + depth);
+        if (!stream->blocks) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        stream->data = stream->blocks + depth;
+        stream->dirty = (unsigned char *)(stream->data + (size_t)depth * blockSize);
+        stream->head = 0;
+        stream->count = 0;
+        stream->next = 0;
+        stream->lastUse = 0;
+    }
+    return streams;
+}
+
+static void streamDestroy(streamBuffer *streams)
+{
+    if (streams) {
+        for (int i = 0; i < NUM_STREAM_BUFFERS; ++i) {
+            free(streams[i].blocks);
+        }
+        free(streams);
+    }
+}
+
+/*
+ * Words within one line were written to memory; keep any stream buffer
+ * copy of them current
+ */
+static void streamUpdate(cacheStruct *cache, int addr, const int *data, int size)
+{
+    for (int i = 0; i < NUM_STREAM_BUFFERS; ++i) {
+        streamBuffer *stream = &cache->streams[i];
+        for (int j = 0; j < stream->count; ++j) {
+            int entry = (stream->head + j) % cache->prefetchDegree;
+            int block = stream->blocks[entry];
+            if (block != -1 && block <= addr && addr < block + cache->blockSize) {
+                memcpy(stream->data + (size_t)entry * cache->blockSize + (addr - block), data,
+                    (size_t)size * sizeof(int));
+            }
+        }
+    }
+}
+
+static void writeBufferDrain(cacheStruct *cache, int addr, int size);
+
+/*
+ * All of a cache's main memory traffic goes through these two so that it
+ * can be counted and captured. Read size words of a line from main memory
+ * into data; counted and captured exactly as size single-word reads were.
+ */
+static int memReadBlock(cacheStruct *cache, int addr, int *data, int size)
+{
+    if (cache->writeBuffer) {
+        // buffered stores to these words must land first
+        writeBufferDrain(cache, addr, size);
+    }
+    if (cache->capture) {
+        for (int i = 0; i < size; ++i) {
+            captureRecord(cache->capture, traceMemRead, addr + i, 0);
+        }
+    }
+    cache->stats.memWords += size;
+    cache->stats.memReadWords += size;
+    if (cache->memory.readBlock) {
+        return cache->memory.readBlock(cache->memory.context, addr, data, size);
+    }
+    for (int i = 0; i < size; ++i) {
+        data[i] = cache->memory.access(cache->memory.context, addr + i, 0, 0);
+    }
+    return 0;
+}
+
+/* Write size words of a line back to main memory; see memReadBlock */
+static void memWriteBlock(cacheStruct *cache, int addr, const int *data, int size)
+{
+    if (cache->capture) {
+        for (int i = 0; i < size; ++i) {
+            captureRecord(cache->capture, traceMemWrite, addr + i, data[i]);
+        }
+    }
+    cache->stats.memWords += size;
+    cache->stats.memWriteWords += size;
+    if (cache->streams) {
+        streamUpdate(cache, addr, data, size);
+    }
+    if (cache->memory.writeBlock) {
+        cache->memory.writeBlock(cache->memory.context, addr, data, size);
+        return;
+    }
+    for (int i = 0; i < size; ++i) {
+        cache->memory.access(cache->memory.context, addr + i, 1, data[i]);
+    }
+}
+
+/* Hand a replaced line, clean or dirty, to a memory with evictBlock */
+static void memEvictBlock(cacheStruct *cache, int addr, const int *data, int size, int dirty)
+{
+    if (cache->capture) {
+        for (int i = 0; i < size; ++i) {
+            captureRecord(cache->capture, traceMemWrite, addr + i, data[i]);
+        }
+    }
+    cache->stats.memWords += size;
+    cache->stats.memWriteWords += size;
+    if (cache->streams) {
+        streamUpdate(cache, addr, data, size);
+    }
+    cache->memory.evictBlock(cache->memory.context, addr, data, size, dirty);
+}
+
+/* The memory a cache uses unless it's given one: the simulator's mem_access */
+static int globalMemAccess(void *context, int addr, int write_flag, int write_data)
+{
+    (void)context;
+    return mem_access(addr, write_flag, write_data);
+}
+
+static inline int getBlockOffset(const cacheStruct *cache, int addr) {
+    // find the block offset
+    if (cache->powerOf2) {
+        return addr & cache->blockMask;
+    }
+    return addr % cache->blockSize;
+}
+
+static inline int getSetOffset(const cacheStruct *cache, int addr) {
+    // find the set offset
+    if (cache->powerOf2) {
+        return (addr >> cache->blockShift) & cache->setMask;
+    }
+    return (addr / cache->blockSize) % cache->numSets;
+}
+
+static inline int getTag(const cacheStruct *cache, int addr) {
+    if (cache->powerOf2) {
+        return addr >> cache->tagShift;
+    }
+    return addr / cache->blockSize / cache->numSets;
+}
+
+/* The first address of the block with this tag in this set */
+static inline int getBlockAddr(const cacheStruct *cache, int tag, int setOffset) {
+    if (cache->powerOf2) {
+        return (tag << cache->tagShift) | (setOffset << cache->blockShift);
+    }
+    return (tag * cache->numSets + setOffset) * cache->blockSize;
+}
+
+/* The data of line blockIndex */
+static inline int *blockData(const cacheStruct *cache, int blockIndex) {
+    return cache->data + (size_t)blockIndex * cache->blockSize;
+}
+
+/*
+ * Find key among the count values of one set. Returns its position, or -1.
+ * Compares 8 (AVX2) or 4 (SSE2) values at a time when the compiler targets
+ * those, which is what makes dense per-set arrays pay off.
+ */
+static inline int findInSet(const int *values, int count, int key) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i key8 = _mm256_set1_epi32(key);
+    for (; i + 8 <= count; i += 8) {
+        __m256i match = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(values + i)), key8);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(match));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i key4 = _mm_set1_epi32(key);
+    for (; i + 4 <= count; i += 4) {
+        __m128i match = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(values + i)), key4);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(match));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        if (values[i] == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* The line in the set starting at setStart that holds tag, or -1 on a miss */
+static inline int findBlock(const cacheStruct *cache, int setStart, int tag) {
+    int way = findInSet(cache->tags + setStart, cache->blocksPerSet, tag);
+    return way == -1 ? -1 : setStart + way;
+}
+
+static void shadowAllocTable(shadowCache *shadow, int tableBits)
+{
+    size_t size = (size_t)1 << tableBits;
+    shadow->keys = malloc(size * sizeof(int));
+    shadow->values = malloc(size * sizeof(int));
+    if (!shadow->keys || !shadow->values) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    memset(shadow->keys, -1, size * sizeof(int));
+    shadow->tableBits = tableBits;
+}
+
+static shadowCache *shadowCreate(int numLines)
+{
+    shadowCache *shadow = malloc(sizeof(shadowCache));
+    if (shadow) {
+        shadow->blocks = malloc((size_t)numLines * 3 * sizeof(int));
+    }
+    if (!shadow || !shadow->blocks) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    shadow->more = shadow->blocks + numLines;
+    shadow->less = shadow->more + numLines;
+    shadow->numLines = numLines;
+    shadow->numFilled = 0;
+    shadow->mru = -1;
+    shadow->lru = -1;
+    shadow->numKeys = 0;
+    shadowAllocTable(shadow, 10);
+    return shadow;
+}
+
+static void shadowDestroy(shadowCache *shadow)
+{
+    if (shadow) {
+        free(shadow->blocks);
+        free(shadow->keys);
+        free(shadow->values);
+        free(shadow);
+    }
+}
+
+/* The table slot that holds block, or the empty slot it belongs in */
+static inline size_t shadowSlot(const shadowCache *shadow, int block)
+{
+    size_t mask = ((size_t)1 << shadow->tableBits) - 1;
+    size_t slot = ((unsigned int)block * 2654435769u) >> (32 - shadow->tableBits);
+    while (shadow->keys[slot] != -1 && shadow->keys[slot] != block) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Double the table, keeping it at most half full */
+static void shadowGrow(shadowCache *shadow)
+{
+    int *keys = shadow->keys;
+    int *values = shadow->values;
+    size_t oldSize = (size_t)1 << shadow->tableBits;
+    shadowAllocTable(shadow, shadow->tableBits + 1);
+    for (size_t i = 0; i < oldSize; ++i) {
+        if (keys[i] != -1) {
+            size_t slot = shadowSlot(shadow, keys[i]);
+            shadow->keys[slot] = keys[i];
+            shadow->values[slot] = values[i];
+        }
+    }
+    free(keys);
+    free(values);
+}
+
+static void shadowUnlink(shadowCache *shadow, int line)
+{
+    if (shadow->more[line] == -1) {
+        shadow->mru = shadow->less[line];
+    } else {
+        shadow->less[shadow->more[line]] = shadow->less[line];
+    }
+    if (shadow->less[line] == -1) {
+        shadow->lru = shadow->more[line];
+    } else {
+        shadow->more[shadow->less[line]] = shadow->more[line];
+    }
+}
+
+static void shadowPushMRU(shadowCache *shadow, int line)
+{
+    shadow->more[line] = -1;
+    shadow->less[line] = shadow->mru;
+    if (shadow->mru == -1) {
+        shadow->lru = line;
+    } else {
+        shadow->more[shadow->mru] = line;
+    }
+    shadow->mru = line;
+}
+
+/* Access the block starting at address block in the shadow cache */
+static enum shadowResult shadowAccess(shadowCache *shadow, int block)
+{
+    if (2 * (shadow->numKeys + 1) > (1 << shadow->tableBits)) {
+        shadowGrow(shadow);
+    }
+    size_t slot = shadowSlot(shadow, block);
+    enum shadowResult result;
+    if (shadow->keys[slot] == -1) {
+        shadow->keys[slot] = block;
+        shadow->values[slot] = -1;
+        ++shadow->numKeys;
+        result = shadowFirst;
+    } else {
+        result = shadow->values[slot] == -1 ? shadowMiss : shadowHit;
+    }
+
+    int line = shadow->values[slot];
+    if (line != -1) {
+        shadowUnlink(shadow, line);
+    } else if (shadow->numFilled < shadow->numLines) {
+        line = shadow->numFilled++;
+    } else {
+        line = shadow->lru;
+        shadowUnlink(shadow, line);
+        shadow->values[shadowSlot(shadow, shadow->blocks[line])] = -1;
+    }
+    shadow->blocks[line] = block;
+    shadow->values[slot] = line;
+    shadowPushMRU(shadow, line);
+    return result;
+}
+
+/*
+ * Replacement policies. Each policy keeps its state in lineRepl and
+ * lineRepl2 (one int per line) and setRepl (two ints per set):
+ *   policyLRU:      lineRepl/lineRepl2 link each way to the next more/less
+ *                   recently used way; setRepl holds the most and least
+ *                   recently used ways. Every update is O(1).
+ *   policyTreePLRU: lineRepl[setStart + n] is bit n of the set's tree
+ *                   (nodes 1 to ways - 1); each bit points at the side to
+ *                   replace next.
+ *   policyBitPLRU:  lineRepl is each line's MRU bit; setRepl[0] counts them.
+ *   policyFIFO:     setRepl[0] is the next way to replace.
+ *   policyRandom:   no state; ways come from the cache's generator.
+ *   policySRRIP/BRRIP: lineRepl is each line's re-reference prediction value.
+ * Policies that could otherwise evict a valid line while the set still has
+ * an invalid one pick the first invalid line instead.
+ */
+#define RRPV_MAX 3
+// BRRIP inserts at RRPV_MAX - 1 once every this many fills, else at RRPV_MAX
+#define BRRIP_INTERVAL 32
+
+typedef struct replacementOps
+{
+    const char *name;
+    void (*init)(cacheStruct *cache, int set, int setStart);
+    int (*victim)(cacheStruct *cache, int set, int setStart); // returns a way
+    void (*hit)(cacheStruct *cache, int set, int setStart, int way);
+    void (*fill)(cacheStruct *cache, int set, int setStart, int way);
+} replacementOps;
+
+static void reuseAllocTable(reuseTracker *tracker, int tableBits)
+{
+    size_t size = (size_t)1 << tableBits;
+    tracker->keys = malloc(size * sizeof(int));
+    tracker->times = malloc(size * sizeof(int));
+    tracker->windows = malloc(size * sizeof(int));
+    if (!tracker->keys || !tracker->times || !tracker->windows) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    memset(tracker->keys, -1, size * sizeof(int));
+    tracker->tableBits = tableBits;
+}
+
+/* A tree of capacity times with the first numMarked marked */
+static void reuseAllocTree(reuseTracker *tracker, int capacity, int numMarked)
+{
+    tracker->tree = malloc(((size_t)capacity + 1) * sizeof(int));
+    tracker->markKeys = malloc(((size_t)capacity + 1) * sizeof(int));
+    if (!tracker->tree || !tracker->markKeys) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    tracker->capacity = capacity;
+    for (int i = 1; i <= capacity; ++i) {
+        tracker->tree[i] = i <= numMarked;
+        tracker->markKeys[i] = -1;
+    }
+    // each node also covers the ones below it, in linear time
+    for (int i = 1; i <= capacity; ++i) {
+        int parent = i + (i & -i);
+        if (parent <= capacity) {
+            tracker->tree[parent] += tracker->tree[i];
+        }
+    }
+}
+
+static void reuseInit(reuseTracker *tracker)
+{
+    memset(tracker, 0, sizeof(reuseTracker));
+    reuseAllocTable(tracker, 10);
+    reuseAllocTree(tracker, MIN_REUSE_TIMES, 0);
+}
+
+static void reuseFree(reuseTracker *tracker)
+{
+    free(tracker->keys);
+    free(tracker->times);
+    free(tracker->windows);
+    free(tracker->tree);
+    free(tracker->markKeys);
+    free(tracker->workingSets);
+}
+
+static reuseProfile *reuseCreate(int window)
+{
+    reuseProfile *reuse = malloc(sizeof(reuseProfile));
+    if (!reuse) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    reuse->window = window;
+    reuse->windowAccesses = 0;
+    reuseInit(&reuse->lines);
+    reuseInit(&reuse->words);
+    return reuse;
+}
+
+static void reuseDestroy(reuseProfile *reuse)
+{
+    if (reuse) {
+        reuseFree(&reuse->lines);
+        reuseFree(&reuse->words);
+        free(reuse);
+    }
+}
+
+/* The table slot that holds key, or the empty slot it belongs in */
+static inline size_t reuseSlot(const reuseTracker *tracker, int key)
+{
+    size_t mask = ((size_t)1 << tracker->tableBits) - 1;
+    size_t slot = ((unsigned int)key * 2654435769u) >> (32 - tracker->tableBits);
+    while (tracker->keys[slot] != -1 && tracker->keys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Double the table, keeping it at most half full */
+static void reuseGrow(reuseTracker *tracker)
+{
+    int *keys = tracker->keys;
+    int *times = tracker->times;
+    int *windows = tracker->windows;
+    size_t oldSize = (size_t)1 << tracker->tableBits;
+    reuseAllocTable(tracker, tracker->tableBits + 1);
+    for (size_t i = 0; i < oldSize; ++i) {
+        if (keys[i] != -1) {
+            size_t slot = reuseSlot(tracker, keys[i]);
+            tracker->keys[slot] = keys[i];
+            tracker->times[slot] = times[i];
+            tracker->windows[slot] = windows[i];
+        }
+    }
+    free(keys);
+    free(times);
+    free(windows);
+}
+
+/*
+ * Renumber the marked times 1, 2, ... in order, in a tree with room for as
+ * many again, once every time has been handed out.
+ */
+static void reuseCompact(reuseTracker *tracker)
+{
+    int *markKeys = tracker->markKeys;
+    int oldNow = tracker->now;
+    free(tracker->tree);
+    int capacity = 2 * tracker->numKeys;
+    reuseAllocTree(tracker, capacity < MIN_REUSE_TIMES ? MIN_REUSE_TIMES : capacity,
+        tracker->numKeys);
+    int time = 0;
+    for (int i = 1; i <= oldNow; ++i) {
+        if (markKeys[i] != -1) {
+            tracker->markKeys[++time] = markKeys[i];
+            tracker->times[reuseSlot(tracker, markKeys[i])] = time;
+        }
+    }
+    tracker->now = time;
+    free(markKeys);
+}
+
+/* Marked times up to and including time */
+static inline int reuseMarksTo(const reuseTracker *tracker, int time)
+{
+    int count = 0;
+    for (; time > 0; time -= time & -time) {
+        count += tracker->tree[time];
+    }
+    return count;
+}
+
+static inline void reuseMark(reuseTracker *tracker, int time, int change)
+{
+    for (; time <= tracker->capacity; time += time & -time) {
+        tracker->tree[time] += change;
+    }
+}
+
+/* Use key now, in the given working set window */
+static void reuseTouch(reuseTracker *tracker, int key, int window)
+{
+    if (tracker->now == tracker->capacity) {
+        reuseCompact(tracker);
+    }
+    int time = ++tracker->now;
+    size_t slot = reuseSlot(tracker, key);
+    if (tracker->keys[slot] == -1) {
+        ++tracker->firstUses;
+        ++tracker->windowKeys;
+        if (2 * (tracker->numKeys + 1) > (1 << tracker->tableBits)) {
+            reuseGrow(tracker);
+            slot = reuseSlot(tracker, key);
+        }
+        tracker->keys[slot] = key;
+        tracker->windows[slot] = window;
+        ++tracker->numKeys;
+    } else {
+        int last = tracker->times[slot];
+        // every other mark is an address used since; this one is the latest
+        int distance = tracker->numKeys - reuseMarksTo(tracker, last);
+        int bucket = 0;
+        while (distance >> bucket && bucket < REUSE_BUCKETS - 1) {
+            ++bucket;
+        }
+        ++tracker->histogram[bucket];
+        reuseMark(tracker, last, -1);
+        tracker->markKeys[last] = -1;
+        if (tracker->windows[slot] != window) {
+            tracker->windows[slot] = window;
+            ++tracker->windowKeys;
+        }
+    }
+    tracker->times[slot] = time;
+    tracker->markKeys[time] = key;
+    reuseMark(tracker, time, 1);
+}
+
+/* Close a tracker's current working set window */
+static void reuseEndWindow(reuseTracker *tracker)
+{
+    if (tracker->numWindows == tracker->windowCapacity) {
+        tracker->windowCapacity = tracker->windowCapacity ? 2 * tracker->windowCapacity : 64;
+        tracker->workingSets = realloc(tracker->workingSets,
+            tracker->windowCapacity * sizeof(int));
+        if (!tracker->workingSets) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+    }
+    tracker->workingSets[tracker->numWindows++] = tracker->windowKeys;
+    tracker->windowKeys = 0;
+}
+
+static void reuseAccess(cacheStruct *cache, int addr)
+{
+    reuseProfile *reuse = cache->reuse;
+    int window = reuse->lines.numWindows;
+    reuseTouch(&reuse->lines, addr / cache->blockSize, window);
+    reuseTouch(&reuse->words, addr, window);
+    if (++reuse->windowAccesses == reuse->window) {
+        reuseEndWindow(&reuse->lines);
+        reuseEndWindow(&reuse->words);
+        reuse->windowAccesses = 0;
+    }
+}
+
+static unsigned int nextRandom(cacheStruct *cache)
+{
+    // xorshift32; each cache has its own so runs are repeatable
+    unsigned int x = cache->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cache->randomState = x;
+    return x;
+}
+
+static int firstInvalid(const cacheStruct *cache, int setStart)
+{
+    return findInSet(cache->tags + setStart, cache->blocksPerSet, -1);
+}
+
+static void lruInit(cacheStruct *cache, int set, int setStart)
+{
+    // same order the LRU labels started in: way 0 is least recently used
+    int ways = cache->blocksPerSet;
+    for (int way = 0; way < ways; ++way) {
+        cache->lineRepl[setStart + way] = way == ways - 1 ? -1 : way + 1;
+        cache->lineRepl2[setStart + way] = way - 1;
+    }
+    cache->setRepl[2 * set] = ways - 1;
+    cache->setRepl[2 * set + 1] = 0;
+}
+
+static int lruVictim(cacheStruct *cache, int set, int setStart)
+{
+    (void)setStart;
+    return cache->setRepl[2 * set + 1];
+}
+
+static void lruTouch(cacheStruct *cache, int set, int setStart, int way)
+{
+    int *moreRecent = cache->lineRepl + setStart;
+    int *lessRecent = cache->lineRepl2 + setStart;
+    int *head = &cache->setRepl[2 * set];
+    int *tail = &cache->setRepl[2 * set + 1];
+    if (*head == way) {
+        return;
+    }
+    // unlink it; it isn't the head, so it has a more recent neighbor
+    int more = moreRecent[way];
+    int less = lessRecent[way];
+    lessRecent[more] = less;
+    if (less == -1) {
+        *tail = more;
+    } else {
+        moreRecent[less] = more;
+    }
+    // and make it the most recent
+    moreRecent[way] = -1;
+    lessRecent[way] = *head;
+    moreRecent[*head] = way;
+    *head = way;
+}
+
+static void treeInit(cacheStruct *cache, int set, int setStart)
+{
+    (void)set;
+    for (int way = 0; way < cache->blocksPerSet; ++way) {
+        cache->lineRepl[setStart + way] = 0;
+    }
+}
+
+static int treeVictim(cacheStruct *cache, int set, int setStart)
+{
+    (void)set;
+    int invalid = firstInvalid(cache, setStart);
+    if (invalid != -1) {
+        return invalid;
+    }
+    const int *bits = cache->lineRepl + setStart;
+    int node = 1;
+    while (node < cache->blocksPerSet) {
+        node = 2 * node + bits[node];
+    }
+    return node - cache->blocksPerSet;
+}
+
+static void treeTouch(cacheStruct *cache, int set, int setStart, int way)
+{
+    (void)set;
+    int *bits = cache->lineRepl + setStart;
+    // point every node on the way up away from this way
+    for (int node = way + cache->blocksPerSet; node > 1; node /= 2) {
+        bits[node / 2] = !(node & 1);
+    }
+}
+
+static void bitInit(cacheStruct *cache, int set, int setStart)
+{
+    for (int way = 0; way < cache->blocksPerSet; ++way) {
+        cache->lineRepl[setStart + way] = 0;
+    }
+    cache->setRepl[2 * set] = 0;
+}
+
+static int bitVictim(cacheStruct *cache, int set, int setStart)
+{
+    (void)set;
+    int invalid = firstInvalid(cache, setStart);
+    if (invalid != -1) {
+        return invalid;
+    }
+    // setting the last bit clears the rest, so there's a clear bit unless
+    // the set only has one line
+    int way = findInSet(cache->lineRepl + setStart, cache->blocksPerSet, 0);
+    return way == -1 ? 0 : way;
+}
+
+static void bitTouch(cacheStruct *cache, int set, int setStart, int way)
+{
+    int *bits = cache->lineRepl + setStart;
+    if (bits[way]) {
+        return;
+    }
+    bits[way] = 1;
+    if (++cache->setRepl[2 * set] == cache->blocksPerSet) {
+        for (int i = 0; i < cache->blocksPerSet; ++i) {
+            bits[i] = i == way;
+        }
+        cache->setRepl[2 * set] = 1;
+    }
+}
+
+static void fifoInit(cacheStruct *cache, int set, int setStart)
+{
+    (void)setStart;
+    cache->setRepl[2 * set] = 0;
+}
+
+static int fifoVictim(cacheStruct *cache, int set, int setStart)
+{
+    (void)setStart;
+    return cache->setRepl[2 * set];
+}
+
+static void noUpdate(cacheStruct *cache, int set, int setStart, int way)
+{
+    (void)cache;
+    (void)set;
+    (void)setStart;
+    (void)way;
+}
+
+static void fifoFill(cacheStruct *cache, int set, int setStart, int way)
+{
+    (void)setStart;
+    cache->setRepl[2 * set] = (way + 1) % cache->blocksPerSet;
+}
+
+static void randomInit(cacheStruct *cache, int set, int setStart)
+{
+    (void)cache;
+    (void)set;
+    (void)setStart;
+}
+
+static int randomVictim(cacheStruct *cache, int set, int setStart)
+{
+    (void)set;
+    int invalid = firstInvalid(cache, setStart);
+    if (invalid != -1) {
+        return invalid;
+    }
+    return nextRandom(cache) % cache->blocksPerSet;
+}
+
+static void rripInit(cacheStruct *cache, int set, int setStart)
+{
+    (void)set;
+    for (int way = 0; way < cache->blocksPerSet; ++way) {
+        cache->lineRepl[setStart + way] = RRPV_MAX;
+    }
+}
+
+static int rripVictim(cacheStruct *cache, int set, int setStart)
+{
+    (void)set;
+    int *rrpv = cache->lineRepl + setStart;
+    for (;;) {
+        int way = findInSet(rrpv, cache->blocksPerSet, RRPV_MAX);
+        if (way != -1) {
+            return way;
+        }
+        // nothing is predicted distant yet, so age the whole set
+        for (int i = 0; i < cache->blocksPerSet; ++i) {
+            ++rrpv[i];
+        }
+    }
+}
+
+static void rripHit(cacheStruct *cache, int set, int setStart, int way)
+{
+    (void)set;
+    cache->lineRepl[setStart + way] = 0;
+}
+
+static void srripFill(cacheStruct *cache, int set, int setStart, int way)
+{
+    (void)set;
+    cache->lineRepl[setStart + way] = RRPV_MAX - 1;
+}
+
+static void brripFill(cacheStruct *cache, int set, int setStart, int way)
+{
+    (void)set;
+    bool longInterval = nextRandom(cache) % BRRIP_INTERVAL == 0;
+    cache->lineRepl[setStart + way] = longInterval ? RRPV_MAX - 1 : RRPV_MAX;
+}
+
+/* Indexed by enum replacementPolicy */
+static const replacementOps replacementPolicies[] = {
+    { "lru", lruInit, lruVictim, lruTouch, lruTouch },
+    { "tree-plru", treeInit, treeVictim, treeTouch, treeTouch },
+    { "bit-plru", bitInit, bitVictim, bitTouch, bitTouch },
+    { "fifo", fifoInit, fifoVictim, noUpdate, fifoFill },
+    { "random", randomInit, randomVictim, noUpdate, noUpdate },
+    { "srrip", rripInit, rripVictim, rripHit, srripFill },
+    { "brrip", rripInit, rripVictim, rripHit, brripFill },
+};
+
+#define NUM_POLICIES ((int)(sizeof(replacementPolicies) / sizeof(replacementPolicies[0])))
+
+const char *cache_policy_name(enum replacementPolicy policy)
+{
+    return replacementPolicies[policy].name;
+}
+
+/*
+ * Look up a policy by the name cache_policy_name gives it.
+ * Returns 0 if there's no such policy.
+ */
+int cache_policy_from_name(const char *name, enum replacementPolicy *policy)
+{
+    for (int i = 0; i < NUM_POLICIES; ++i) {
+        if (!strcmp(name, replacementPolicies[i].name)) {
+            *policy = (enum replacementPolicy)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Indexed by enum prefetcher */
+static const char *const prefetcherNames[] = { "none", "next-line", "stride", "stream" };
+#define NUM_PREFETCHERS ((int)(sizeof(prefetcherNames) / sizeof(prefetcherNames[0])))
+
+const char *cache_prefetcher_name(enum prefetcher prefetcher)
+{
+    return prefetcherNames[prefetcher];
+}
+
+/*
+ * Set config's prefetcher from "<name>" or "<name>:<degree>".
+ * Returns 0 if text isn't one of those.
+ */
+int cache_prefetch_parse(const char *text, cacheConfig *config)
+{
+    const char *colon = strchr(text, ':');
+    size_t length = colon ? (size_t)(colon - text) : strlen(text);
+    for (int i = 0; i < NUM_PREFETCHERS; ++i) {
+        if (strlen(prefetcherNames[i]) != length || strncmp(text, prefetcherNames[i], length)) {
+            continue;
+        }
+        int degree = config->prefetchDegree;
+        if (colon) {
+            char *end;
+            degree = (int)strtol(colon + 1, &end, 10);
+            if (end == colon + 1 || *end != '\0') {
+                return 0;
+            }
+        }
+        config->prefetcher = (enum prefetcher)i;
+        config->prefetchDegree = degree;
+        return 1;
+    }
+    return 0;
+}
+
+/* Indexed by enum writePolicy */
+static const char *const writePolicyNames[] = { "write-back", "write-through" };
+#define NUM_WRITE_POLICIES ((int)(sizeof(writePolicyNames) / sizeof(writePolicyNames[0])))
+
+const char *cache_write_policy_name(enum writePolicy policy)
+{
+    return writePolicyNames[policy];
+}
+
+/*
+ * Set config's write settings from '+' separated words: a write policy
+ * name, "allocate" or "no-allocate", and "buffer:<lines>", e.g.
+ * "write-through+no-allocate+buffer:8". Settings not given are left as
+ * they were. Returns 0 if text isn't in that form.
+ */
+int cache_write_parse(const char *text, cacheConfig *config)
+{
+    cacheConfig result = *config;
+    const char *word = text;
+    for (;;) {
+        const char *end = strchr(word, '+');
+        size_t length = end ? (size_t)(end - word) : strlen(word);
+        bool known = false;
+        for (int i = 0; i < NUM_WRITE_POLICIES; ++i) {
+            if (strlen(writePolicyNames[i]) == length && !strncmp(word, writePolicyNames[i], length)) {
+                result.writePolicy = (enum writePolicy)i;
+                known = true;
+            }
+        }
+        if (length == strlen("allocate") && !strncmp(word, "allocate", length)) {
+            result.writeAllocate = 1;
+            known = true;
+        } else if (length == strlen("no-allocate") && !strncmp(word, "no-allocate", length)) {
+            result.writeAllocate = 0;
+            known = true;
+        } else if (length > strlen("buffer:") && !strncmp(word, "buffer:", strlen("buffer:"))) {
+            char *numberEnd;
+            result.writeBufferEntries = (int)strtol(word + strlen("buffer:"), &numberEnd, 10);
+            known = numberEnd == word + length;
+        }
+        if (!known) {
+            return 0;
+        }
+        if (!end) {
+            break;
+        }
+        word = end + 1;
+    }
+    *config = result;
+    return 1;
+}
+
+/* Describe config's write settings the way cache_write_parse reads them */
+void cache_write_format(const cacheConfig *config, char *text, int size)
+{
+    int length = snprintf(text, size, "%s", cache_write_policy_name(config->writePolicy));
+    if (!config->writeAllocate && length < size) {
+        length += snprintf(text + length, size - length, "+no-allocate");
+    }
+    if (config->writeBufferEntries && length < size) {
+        snprintf(text + length, size - length, "+buffer:%d", config->writeBufferEntries);
+    }
+}
+
+/*
+ * Turn on timing and set it from "<hit latency>:<miss penalty>:<words per
+ * cycle>[:<MSHRs>]", e.g. "1:100:2:8"; without MSHRs the cache blocks.
+ * Returns 0 if text isn't in that form.
+ */
+int cache_timing_parse(const char *text, cacheConfig *config)
+{
+    long values[4] = { 0, 0, 0, 0 };
+    const char *next = text;
+    int count = 0;
+    while (count < 4) {
+        char *end;
+        values[count++] = strtol(next, &end, 10);
+        if (end == next) {
+            return 0;
+        }
+        if (*end == '\0') {
+            break;
+        }
+        if (*end != ':') {
+            return 0;
+        }
+        next = end + 1;
+    }
+    if (count < 3 || strchr(next, ':')) {
+        return 0;
+    }
+    config->timing = 1;
+    config->hitLatency = (int)values[0];
+    config->missPenalty = (int)values[1];
+    config->memoryBandwidth = (int)values[2];
+    config->mshrs = (int)values[3];
+    return 1;
+}
+
+/*
+ * Fill in a configuration with the given shape and default settings.
+ */
+void cache_config_init(cacheConfig *config, int blockSize, int numSets, int blocksPerSet)
+{
+    config->blockSize = blockSize;
+    config->numSets = numSets;
+    config->blocksPerSet = blocksPerSet;
+    config->policy = policyLRU;
+    config->classifyMisses = 0;
+    config->prefetcher = prefetchNone;
+    config->prefetchDegree = DEFAULT_PREFETCH_DEGREE;
+    config->writePolicy = writeBack;
+    config->writeAllocate = 1;
+    config->writeBufferEntries = 0;
+    config->victimEntries = 0;
+    config->timing = 0;
+    config->hitLatency = DEFAULT_HIT_LATENCY;
+    config->missPenalty = DEFAULT_MISS_PENALTY;
+    config->memoryBandwidth = 1;
+    config->mshrs = 0;
+    config->sampleInterval = 1;
+    config->reuseWindow = 0;
+}
+
+/*
+ * Check a configuration. Returns why it can't be simulated, or NULL if it can.
+ */
+const char *cache_config_error(const cacheConfig *config)
+{
+    if (config->blockSize <= 0 || config->numSets <= 0 || config->blocksPerSet <= 0) {
+        return "input parameters must be positive numbers";
+    }
+    long long words = (long long)config->blockSize * config->numSets * config->blocksPerSet;
+    if (words > MAX_CACHE_WORDS) {
+        return "cache must be no larger than 2^28 words";
+    }
+    if ((int)config->policy < 0 || (int)config->policy >= NUM_POLICIES) {
+        return "unknown replacement policy";
+    }
+    if (config->policy == policyTreePLRU && !is_power_of_2(config->blocksPerSet)) {
+        return "tree-plru needs a power of 2 lines per set";
+    }
+    if ((int)config->prefetcher < 0 || (int)config->prefetcher >= NUM_PREFETCHERS) {
+        return "unknown prefetcher";
+    }
+    if (config->prefetchDegree < 1 || config->prefetchDegree > MAX_PREFETCH_DEGREE) {
+        return "prefetch degree must be 1 to 64";
+    }
+    if ((int)config->writePolicy < 0 || (int)config->writePolicy >= NUM_WRITE_POLICIES) {
+        return "unknown write policy";
+    }
+    if (config->writeBufferEntries < 0 || config->writeBufferEntries > MAX_WRITE_BUFFER_ENTRIES) {
+        return "write buffer must hold 0 to 64 lines";
+    }
+    if (config->victimEntries < 0 || config->victimEntries > MAX_VICTIM_ENTRIES) {
+        return "victim cache must hold 0 to 64 lines";
+    }
+    if (config->timing && (config->hitLatency < 1 || config->missPenalty < 0
+            || config->memoryBandwidth < 1)) {
+        return "timing needs a hit latency and bandwidth of at least 1";
+    }
+    if (config->timing && (config->mshrs < 0 || config->mshrs > MAX_MSHRS)) {
+        return "MSHRs must number 0 to 64";
+    }
+    if (config->reuseWindow < 0) {
+        return "reuse profiling needs a window of at least 1 access";
+    }
+    if (config->sampleInterval < 1 || config->sampleInterval > config->numSets) {
+        return "set sampling interval must be 1 to the number of sets";
+    }
+    // whatever looks beyond an access's own set would see the dropped ones missing
+    if (config->sampleInterval > 1 && (config->classifyMisses
+            || config->prefetcher != prefetchNone || config->writeBufferEntries
+            || config->victimEntries || config->timing)) {
+        return "set sampling can't classify misses, prefetch, buffer writes, "
+            "have a victim cache or model time";
+    }
+    return NULL;
+}
+
+static int levelAccess(void *context, int addr, int write_flag, int write_data);
+static void victimWriteBlock(void *context, int addr, const int *data, int size);
+static int exclusiveReadBlock(void *context, int addr, int *data, int size);
+static void exclusiveEvictBlock(void *context, int addr, const int *data, int size, int dirty);
+
+#ifdef CACHE_PROFILE
+static inline long long profileClock(void)
+{
+#ifdef PROFILE_TSC
+    return (long long)__rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+static inline void profileAdd(profileState *profile, enum profileTimer timer, long long start)
+{
+    ++profile->calls[timer];
+    profile->ticks[timer] += profileClock() - start;
+}
+
+/*
+ * Count a demand lookup in set. way is where the tag matched, or -1 on a
+ * miss, after comparing every tag in the set; a linear scan stops at the
+ * match, so that's how many tags it compares.
+ */
+static inline void profileLookup(profileState *profile, int set, int way, int blocksPerSet)
+{
+    if (way == -1) {
+        ++profile->scanLengths[blocksPerSet - 1];
+        ++profile->setMisses[set];
+    } else {
+        ++profile->scanLengths[way];
+        ++profile->setHits[set];
+    }
+}
+
+static profileState *profileCreate(int numSets, int blocksPerSet)
+{
+    profileState *profile = calloc(1, sizeof(profileState));
+    if (profile) {
+        profile->scanLengths = calloc(blocksPerSet, sizeof(long long));
+        profile->setHits = calloc(3 * (size_t)numSets, sizeof(long long));
+    }
+    if (!profile || !profile->scanLengths || !profile->setHits) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    profile->setMisses = profile->setHits + numSets;
+    profile->setEvictions = profile->setMisses + numSets;
+    return profile;
+}
+
+static void profileDestroy(profileState *profile)
+{
+    if (profile) {
+        free(profile->scanLengths);
+        free(profile->setHits);
+        free(profile);
+    }
+}
+#endif
+
+/* Bytes in the arena of a cache this shape */
+static size_t arenaSize(int blockSize, int numSets, int blocksPerSet)
+{
+    size_t numLines = (size_t)numSets * blocksPerSet;
+    return numLines * (3 * sizeof(int) + 3 * sizeof(unsigned char))
+        + 2 * (size_t)numSets * sizeof(int) + numLines * blockSize * sizeof(int);
+}
+
+/* Point a cache's per-line arrays into arena, laid out as arenaSize counts */
+static void placeArena(cacheStruct *cache, char *arena)
+{
+    int numLines = cache->numSets * cache->blocksPerSet;
+    size_t numWords = (size_t)numLines * cache->blockSize;
+    cache->tags = (int *)arena;
+    cache->lineRepl = cache->tags + numLines;
+    cache->lineRepl2 = cache->lineRepl + numLines;
+    cache->setRepl = cache->lineRepl2 + numLines;
+    cache->data = cache->setRepl + 2 * cache->numSets;
+    cache->dirty = (unsigned char *)(cache->data + numWords);
+    cache->prefetched = cache->dirty + numLines;
+    cache->shared = cache->prefetched + numLines;
+}
+
+/*
+ * Create a cache with the given configuration. Misses and writebacks go to
+ * memory, or to mem_access if memory is NULL. Returns NULL if the
+ * configuration is invalid (see cache_config_error).
+ */
+cacheStruct *cache_handle_create(const cacheConfig *config, const cacheMemory *memory)
+{
+    if (cache_config_error(config)) {
+        return NULL;
+    }
+    int numLines = config->numSets * config->blocksPerSet;
+    size_t numWords = (size_t)numLines * config->blockSize;
+    cacheStruct *cache = malloc(sizeof(cacheStruct));
+    // one arena holds all of the per-line arrays
+    char *arena = malloc(arenaSize(config->blockSize, config->numSets, config->blocksPerSet));
+    if (!cache || !arena) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    cache->blockSize = config->blockSize;
+    cache->numSets = config->numSets;
+    cache->blocksPerSet = config->blocksPerSet;
+    placeArena(cache, arena);
+    cache->mapping = NULL;
+    cache->mappingSize = 0;
+    cache->warming = false;
+#ifdef CACHE_PROFILE
+    cache->profile = profileCreate(config->numSets, config->blocksPerSet);
+#endif
+    memset(&cache->stats, 0, sizeof(cache->stats));
+    cache->outputMode = outputText;
+    cache->victim = NULL;
+    cache->victimLine = NULL;
+    if (config->victimEntries) {
+        cacheConfig victimConfig;
+        cache_config_init(&victimConfig, config->blockSize, 1, config->victimEntries);
+        victimConfig.writePolicy = config->writePolicy;
+        cache->victim = cache_handle_create(&victimConfig, memory);
+        cache_handle_set_output(cache->victim, outputNone);
+        cache->victimLine = malloc((size_t)config->blockSize * sizeof(int));
+        if (!cache->victimLine) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+    }
+    cache_handle_set_memory(cache, memory);
+    cache->capture = NULL;
+    cache->events = NULL;
+    cache->shadow = config->classifyMisses ? shadowCreate(numLines) : NULL;
+    cache->reuse = config->reuseWindow ? reuseCreate(config->reuseWindow) : NULL;
+    cache->evictHook = NULL;
+    cache->evictContext = NULL;
+    cache->holes = false;
+    cache->sibling = NULL;
+    cache->moveFromSibling = false;
+    cache->prefetcher = config->prefetcher;
+    cache->prefetchDegree = config->prefetchDegree;
+    cache->lastFetch = -1;
+    cache->strides = NULL;
+    cache->streams = NULL;
+    cache->streamClock = 0;
+    cache->refill = NULL;
+    cache->streamMiss = -1;
+    cache->writePolicy = config->writePolicy;
+    cache->writeAllocate = config->writeAllocate != 0;
+    cache->writeBuffer = config->writeBufferEntries
+        ? writeBufferCreate(config->blockSize, config->writeBufferEntries) : NULL;
+    cache->timing = config->timing ? timingCreate(config) : NULL;
+    cache->sampleInterval = config->sampleInterval;
+    cache->samples = NULL;
+    if (config->sampleInterval > 1) {
+        int numSamples = (config->numSets + config->sampleInterval - 1) / config->sampleInterval;
+        cache->samples = calloc(numSamples, sizeof(sampleCounts));
+        if (!cache->samples) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+    }
+    if (cache->prefetcher == prefetchStride) {
+        cache->strides = malloc(STRIDE_TABLE_SIZE * sizeof(strideEntry));
+        if (!cache->strides) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        for (int i = 0; i < STRIDE_TABLE_SIZE; ++i) {
+            cache->strides[i].pc = -1;
+        }
+    } else if (cache->prefetcher == prefetchStream) {
+        cache->streams = streamCreate(cache->blockSize, cache->prefetchDegree);
+    }
+
+    // With power of 2 sizes, the offset, set and tag are just bit fields of
+    // the address. Otherwise fall back to dividing by the sizes.
+    cache->powerOf2 = is_power_of_2(cache->blockSize) && is_power_of_2(cache->numSets);
+    cache->blockShift = 0;
+    while ((1 << cache->blockShift) < cache->blockSize) {
+        ++cache->blockShift;
+    }
+    int setShift = 0;
+    while ((1 << setShift) < cache->numSets) {
+        ++setShift;
+    }
+    cache->blockMask = cache->blockSize - 1;
+    cache->setMask = cache->numSets - 1;
+    cache->tagShift = cache->blockShift + setShift;
+
+    // Set all values in the cache blocks to -1
+    for (size_t i = 0; i < numWords; ++i) {
+        cache->data[i] = -1;
+    }
+    for (int i = 0; i < numLines; ++i) {
+        cache->dirty[i] = 0;
+        cache->prefetched[i] = 0;
+        cache->shared[i] = 0;
+        cache->tags[i] = -1;
+    }
+    cache->policy = &replacementPolicies[config->policy];
+    cache->randomState = 1;
+    for (int set = 0; set < cache->numSets; ++set) {
+        cache->policy->init(cache, set, set * cache->blocksPerSet);
+    }
+    return cache;
+}
+
+/*
+ * Send a cache's misses and writebacks to memory from now on, or to
+ * mem_access if memory is NULL.
+ */
+void cache_handle_set_memory(cacheStruct *cache, const cacheMemory *memory)
+{
+    if (cache->victim) {
+        // the victim cache sits between this cache and memory
+        cache_handle_set_memory(cache->victim, memory);
+        cache->memory.access = levelAccess;
+        cache->memory.readBlock = exclusiveReadBlock;
+        cache->memory.writeBlock = victimWriteBlock;
+        cache->memory.evictBlock = exclusiveEvictBlock;
+        cache->memory.context = cache->victim;
+        cache->memory.size = 0; // see memorySize
+    } else if (memory) {
+        cache->memory = *memory;
+    } else {
+        cache->memory.access = globalMemAccess;
+        cache->memory.readBlock = NULL;
+        cache->memory.writeBlock = NULL;
+        cache->memory.evictBlock = NULL;
+        cache->memory.context = NULL;
+        cache->memory.size = LC2K_MEMORY_WORDS;
+    }
+}
+
+/* Free a cache's arena, or unmap the checkpoint it lives in */
+static void releaseArena(cacheStruct *cache)
+{
+#ifdef CACHE_MMAP
+    if (cache->mapping) {
+        munmap(cache->mapping, cache->mappingSize);
+        cache->mapping = NULL;
+        return;
+    }
+#endif
+    free(cache->tags); // the start of the arena
+}
+
+void cache_handle_destroy(cacheStruct *cache)
+{
+    if (!cache) {
+        return;
+    }
+    cache_handle_capture_stop(cache);
+    cache_handle_log_stop(cache);
+    shadowDestroy(cache->shadow);
+    reuseDestroy(cache->reuse);
+    free(cache->strides);
+    streamDestroy(cache->streams);
+    writeBufferDestroy(cache->writeBuffer);
+    cache_handle_destroy(cache->victim);
+    free(cache->victimLine);
+    timingDestroy(cache->timing);
+    free(cache->samples);
+#ifdef CACHE_PROFILE
+    profileDestroy(cache->profile);
+#endif
+    releaseArena(cache);
+    free(cache);
+}
+
+/*
+ * Select how a cache's actions are reported. The LC-2K simulator always uses
+ * outputText; trace replay can use outputNone to skip per-access printing.
+ * outputBinary only has an effect while an event log is open.
+ */
+void cache_handle_set_output(cacheStruct *cache, enum outputMode mode)
+{
+    cache->outputMode = mode;
+}
+
+/*
+ * Copy out a cache's counters for the run so far.
+ */
+void cache_handle_stats(const cacheStruct *cache, cacheStats *stats)
+{
+    *stats = cache->stats;
+    int numLines = cache->numSets * cache->blocksPerSet;
+    for (int i = 0; i < numLines; ++i) {
+        stats->dirtyLeft += cache->dirty[i];
+    }
+    if (cache->writeBuffer) {
+        stats->bufferedLeft = cache->writeBuffer->count;
+    }
+    if (cache->victim) {
+        const cacheStats *victim = &cache->victim->stats;
+        stats->victimHits = victim->hits;
+        stats->victimMisses = victim->misses;
+        stats->victimWritebacks = victim->writebacks;
+        stats->victimMemWords = victim->memWords;
+    }
+    if (cache->timing) {
+        stats->cycles = timingEnd(cache->timing);
+    }
+}
+
+/*
+ * Warm the cache functionally from now on, or stop. While warming, accesses
+ * only update what decides later hits and misses (see warmAccess) and read
+ * as 0; the data in lines filled meanwhile is not kept, so this is for
+ * trace replay. See cache_config_warming_error for what can be warmed.
+ */
+void cache_handle_set_warming(cacheStruct *cache, int warming)
+{
+    cache->warming = warming != 0;
+}
+
+/* The counters a sampled run measures, without the rest of cache_handle_stats */
+void cache_handle_counts(const cacheStruct *cache, sampleCounts *counts)
+{
+    counts->accesses = cache->stats.hits + cache->stats.misses;
+    counts->misses = cache->stats.misses;
+    counts->writebacks = cache->stats.writebacks;
+}
+
+/*
+ * Add stats's counters to total's, e.g. to combine caches that each
+ * simulated part of one cache's sets.
+ */
+void cache_stats_add(cacheStats *total, const cacheStats *stats)
+{
+    // every counter is a long long
+    long long *to = (long long *)total;
+    const long long *from = (const long long *)stats;
+    for (size_t i = 0; i < sizeof(cacheStats) / sizeof(long long); ++i) {
+        to[i] += from[i];
+    }
+}
+
+/* Why a cache's state can't be checkpointed, or NULL if it can */
+static const char *checkpointError(const cacheStruct *cache)
+{
+    // everything a checkpoint doesn't hold has to be empty or absent
+    if (cache->shadow || cache->prefetcher != prefetchNone || cache->writeBuffer
+        || cache->victim || cache->timing || cache->samples || cache->reuse) {
+        return "checkpoints can't hold miss classification, prefetchers, write buffers, "
+            "victim caches, timing, set sampling or reuse profiles";
+    }
+    if (cache->evictHook || cache->sibling) {
+        return "checkpoints need a single cache";
+    }
+    return NULL;
+}
+
+/*
+ * Save a cache's state to path: every line's tag, dirty bit, replacement
+ * state and data, and the counters so far. Main memory isn't saved, only
+ * memoryAccesses, its count of accesses, for the restoring run to carry on
+ * from.
+ */
+void cache_handle_checkpoint(const cacheStruct *cache, const char *path,
+    long long memoryAccesses)
+{
+    const char *error = checkpointError(cache);
+    if (error) {
+        printf("error: %s\n", error);
+        exit(1);
+    }
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        printf("error: can't open checkpoint %s for writing\n", path);
+        exit(1);
+    }
+    char *page = calloc(1, CHECKPOINT_ARENA_OFFSET);
+    if (!page) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    checkpointHeader *header = (checkpointHeader *)page;
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header->version = CHECKPOINT_VERSION;
+    header->blockSize = cache->blockSize;
+    header->numSets = cache->numSets;
+    header->blocksPerSet = cache->blocksPerSet;
+    header->policy = (int32_t)(cache->policy - replacementPolicies);
+    header->randomState = cache->randomState;
+    header->holes = cache->holes;
+    header->statsSize = sizeof(cacheStats);
+    header->arenaSize = arenaSize(cache->blockSize, cache->numSets, cache->blocksPerSet);
+    header->memoryAccesses = memoryAccesses;
+    header->stats = cache->stats;
+    if (fwrite(page, CHECKPOINT_ARENA_OFFSET, 1, file) != 1
+        || fwrite(cache->tags, header->arenaSize, 1, file) != 1 || fclose(file)) {
+        printf("error: can't write checkpoint %s\n", path);
+        exit(1);
+    }
+    free(page);
+}
+
+/*
+ * Replace a cache's state with the one saved at path, which must be from a
+ * cache of the same shape and replacement policy. Where there's mmap the
+ * file is mapped in copy-on-write rather than read, so restoring a large
+ * cache is quick and the caches of several runs from one checkpoint share
+ * its pages until they change them. Returns the count of main memory
+ * accesses the checkpoint was saved with.
+ */
+long long cache_handle_restore(cacheStruct *cache, const char *path)
+{
+    const char *error = checkpointError(cache);
+    if (error) {
+        printf("error: %s\n", error);
+        exit(1);
+    }
+    FILE *file = fopen(path, "rb");
+    checkpointHeader header;
+    if (!file) {
+        printf("error: can't open checkpoint %s\n", path);
+        exit(1);
+    }
+    size_t size = arenaSize(cache->blockSize, cache->numSets, cache->blocksPerSet);
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC))
+        || header.version != CHECKPOINT_VERSION || header.statsSize != sizeof(cacheStats)) {
+        printf("error: %s is not a checkpoint this simulator can read\n", path);
+        exit(1);
+    }
+    if (header.blockSize != cache->blockSize || header.numSets != cache->numSets
+        || header.blocksPerSet != cache->blocksPerSet
+        || header.policy != (int32_t)(cache->policy - replacementPolicies)
+        || header.arenaSize != size) {
+        printf("error: checkpoint %s is of a different cache\n", path);
+        exit(1);
+    }
+    releaseArena(cache);
+#ifdef CACHE_MMAP
+    size_t mappingSize = CHECKPOINT_ARENA_OFFSET + size;
+    struct stat status;
+    int fd = fileno(file);
+    void *mapping = MAP_FAILED;
+    if (!fstat(fd, &status) && (size_t)status.st_size >= mappingSize) {
+        mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        printf("error: can't map checkpoint %s\n", path);
+        exit(1);
+    }
+    cache->mapping = mapping;
+    cache->mappingSize = mappingSize;
+    placeArena(cache, (char *)mapping + CHECKPOINT_ARENA_OFFSET);
+#else
+    char *arena = malloc(size);
+    if (!arena) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    if (fseek(file, CHECKPOINT_ARENA_OFFSET, SEEK_SET) || fread(arena, size, 1, file) != 1) {
+        printf("error: checkpoint %s is short\n", path);
+        exit(1);
+    }
+    placeArena(cache, arena);
+#endif
+    fclose(file);
+    cache->randomState = header.randomState;
+    cache->holes = header.holes != 0;
+    cache->stats = header.stats;
+    return header.memoryAccesses;
+}
+
+static void checkpointGlobalCache(void)
+{
+    if (globalCache && !globalHierarchy) {
+        cache_checkpoint(getenv("CACHE_CHECKPOINT"), get_num_mem_accesses());
+    }
+}
+
+static void stopGlobalCapture(void)
+{
+    if (globalCache) {
+        cache_handle_capture_stop(globalCache);
+    }
+}
+
+static void stopGlobalLog(void)
+{
+    if (globalHierarchy) {
+        cache_hierarchy_log_stop(globalHierarchy);
+    } else if (globalCache) {
+        cache_handle_log_stop(globalCache);
+    }
+}
+
+/* Get rid of the global cache, or the hierarchy it's part of */
+static void destroyGlobalCache(void)
+{
+    if (globalHierarchy) {
+        cache_hierarchy_destroy(globalHierarchy);
+    } else {
+        cache_handle_destroy(globalCache);
+    }
+    globalHierarchy = NULL;
+    globalCache = NULL;
+}
+
+/* The warnings and the description of a cache printed at startup */
+static void printConfig(const cacheConfig *config)
+{
+    if (!is_power_of_2(config->blockSize)) {
+        printf("warning: blockSize %d is not a power of 2\n", config->blockSize);
+    }
+    if (!is_power_of_2(config->numSets)) {
+        printf("warning: numSets %d is not a power of 2\n", config->numSets);
+    }
+    printf("Simulating a cache with %d total lines; each line has %d words\n",
+        config->numSets * config->blocksPerSet, config->blockSize);
+    printf("Each set in the cache contains %d lines; there are %d sets\n",
+        config->blocksPerSet, config->numSets);
+}
+
+/* Print what cache_init_config would about a cache */
+void cache_config_print(const cacheConfig *config)
+{
+    printConfig(config);
+}
+
+/* The set that addr falls in, in a cache with this configuration */
+int cache_config_set(const cacheConfig *config, int addr)
+{
+    return addr / config->blockSize % config->numSets;
+}
+
+/*
+ * Check that a cache can be simulated a range of sets at a time, on
+ * separate instances that only see their own sets' accesses and add up to
+ * the whole. Sets of an LRU, write-back cache never interact, but these
+ * settings share state across sets. Returns why it can't, or NULL if it can.
+ */
+const char *cache_config_set_parallel_error(const cacheConfig *config)
+{
+    if (config->policy == policyRandom || config->policy == policyBRRIP) {
+        return "random and brrip replacement draw from one generator for all sets";
+    }
+    if (config->classifyMisses) {
+        return "miss classification models one fully associative cache";
+    }
+    if (config->prefetcher != prefetchNone) {
+        return "prefetchers work across sets";
+    }
+    if (config->writeBufferEntries || config->victimEntries) {
+        return "write buffers and victim caches hold lines from every set";
+    }
+    if (config->timing) {
+        return "timing keeps one clock for all sets";
+    }
+    if (config->sampleInterval > 1) {
+        return "set sampling estimates from one cache's sets";
+    }
+    if (config->reuseWindow) {
+        return "reuse distances span all sets";
+    }
+    return NULL;
+}
+
+/*
+ * Check that a cache can be warmed functionally: that its tags, dirty bits
+ * and replacement state are all a later access depends on. Returns why it
+ * can't be, or NULL if it can.
+ */
+const char *cache_config_warming_error(const cacheConfig *config)
+{
+    if (config->classifyMisses || config->prefetcher != prefetchNone
+        || config->writeBufferEntries || config->victimEntries || config->timing
+        || config->sampleInterval > 1) {
+        return "functional warming can't classify misses, prefetch, buffer writes, "
+            "have a victim cache, model time or sample sets";
+    }
+    return NULL;
+}
+
+/*
+ * Apply the settings the LC-2K simulator's command line has no room for,
+ * from the environment:
+ *   CACHE_POLICY=<name>  replacement policy (see cache_policy_name)
+ *   CACHE_STATS=detail   classify misses, and have printStats print the
+ *                        full breakdown after the usual summary
+ *   CACHE_PREFETCH=<name>[:<degree>]  prefetcher (see cache_prefetcher_name)
+ *   CACHE_WRITE=<settings>  write policy, allocation and write buffer (see
+ *                        cache_write_parse)
+ *   CACHE_VICTIM=<lines>  a victim cache of that many lines
+ *   CACHE_TIMING=<timing>  model time (see cache_timing_parse)
+ *   CACHE_REUSE=<accesses>  profile reuse distances, and working sets over
+ *                        windows of that many accesses
+ */
+void cache_config_from_env(cacheConfig *config)
+{
+    const char *policyName = getenv("CACHE_POLICY");
+    if (policyName && *policyName && !cache_policy_from_name(policyName, &config->policy)) {
+        printf("error: unknown replacement policy %s\n", policyName);
+        exit(1);
+    }
+    const char *stats = getenv("CACHE_STATS");
+    if (stats && !strcmp(stats, "detail")) {
+        config->classifyMisses = 1;
+    }
+    const char *prefetch = getenv("CACHE_PREFETCH");
+    if (prefetch && *prefetch && !cache_prefetch_parse(prefetch, config)) {
+        printf("error: unknown prefetcher %s\n", prefetch);
+        exit(1);
+    }
+    const char *write = getenv("CACHE_WRITE");
+    if (write && *write && !cache_write_parse(write, config)) {
+        printf("error: unknown write settings %s\n", write);
+        exit(1);
+    }
+    const char *victim = getenv("CACHE_VICTIM");
+    if (victim && *victim) {
+        char *end;
+        config->victimEntries = (int)strtol(victim, &end, 10);
+        if (*end != '\0') {
+            printf("error: bad victim cache size %s\n", victim);
+            exit(1);
+        }
+    }
+    const char *timing = getenv("CACHE_TIMING");
+    if (timing && *timing && !cache_timing_parse(timing, config)) {
+        printf("error: CACHE_TIMING must be <hit latency>:<miss penalty>:<words per cycle>[:<MSHRs>]\n");
+        exit(1);
+    }
+    const char *reuse = getenv("CACHE_REUSE");
+    if (reuse && *reuse) {
+        char *end;
+        config->reuseWindow = (int)strtol(reuse, &end, 10);
+        if (*end != '\0' || config->reuseWindow < 1) {
+            printf("error: bad reuse profile window %s\n", reuse);
+            exit(1);
+        }
+    }
+}
+
+/*
+ * Add the levels the environment asks for to a hierarchy of just L1:
+ *   CACHE_L1I=<line size>,<sets>,<lines per set>  split L1; fetches go here
+ *   CACHE_L2=<line size>,<sets>,<lines per set>   (and CACHE_L3) lower levels
+ *   CACHE_INCLUSION=<name>  non-inclusive (default), inclusive or exclusive
+ * Every cache gets L1's replacement policy and other settings, except
+ * that only L1 prefetches, has a victim cache, models time or profiles reuse.
+ */
+void cache_hierarchy_config_from_env(hierarchyConfig *config)
+{
+    static const char *const variables[] = { "CACHE_L1I", "CACHE_L2", "CACHE_L3" };
+    for (int i = 0; i < MAX_CACHE_LEVELS; ++i) {
+        const char *text = getenv(variables[i]);
+        if (!text || !*text) {
+            continue;
+        }
+        cacheConfig level;
+        if (!cache_config_parse(text, &level)) {
+            printf("error: %s must be <line size>,<sets>,<lines per set>\n", variables[i]);
+            exit(1);
+        }
+        if (i > 0 && config->numLevels != i) {
+            printf("error: %s needs the levels above it\n", variables[i]);
+            exit(1);
+        }
+        cacheConfig shape = level;
+        level = config->levels[0];
+        level.blockSize = shape.blockSize;
+        level.numSets = shape.numSets;
+        level.blocksPerSet = shape.blocksPerSet;
+        if (i == 0) {
+            config->splitL1 = 1;
+            config->l1i = level;
+        } else {
+            level.prefetcher = prefetchNone;
+            level.victimEntries = 0;
+            level.timing = 0;
+            level.reuseWindow = 0;
+            config->levels[config->numLevels++] = level;
+        }
+    }
+    const char *inclusion = getenv("CACHE_INCLUSION");
+    if (inclusion && *inclusion && !cache_inclusion_from_name(inclusion, &config->inclusion)) {
+        printf("error: unknown inclusion policy %s\n", inclusion);
+        exit(1);
+    }
+}
+
+/*
+ * cache_init with a full configuration, for front-ends that set more than
+ * the shape of the cache.
+ * Setting CACHE_TRACE=<file> in the environment captures the run to <file>,
+ * and CACHE_EVENTS=<file> logs cache actions to <file> in binary instead
+ * of printing them. CACHE_CHECKPOINT=<file> saves a checkpoint (see
+ * cache_handle_checkpoint) when the program exits. Checkpoints don't hold
+ * main memory, so restoring one under a loaded program would put the old
+ * run's lines in front of it; CACHE_RESTORE is refused, and front-ends that
+ * own their memory restore with cache_restore instead.
+ */
+void cache_init_config(const cacheConfig *config)
+{
+    const char *error = cache_config_error(config);
+    if (error) {
+        printf("error: %s\n", error);
+        exit(1);
+    }
+    printConfig(config);
+
+    destroyGlobalCache();
+    globalCache = cache_handle_create(config, NULL);
+
+    const char *capturePath = getenv("CACHE_TRACE");
+    if (capturePath && *capturePath) {
+        cache_handle_capture_start(globalCache, capturePath);
+        // the simulator calls printStats at halt, but make sure we finish the file
+        atexit(stopGlobalCapture);
+    }
+    const char *eventPath = getenv("CACHE_EVENTS");
+    if (eventPath && *eventPath) {
+        cache_handle_log_start(globalCache, eventPath);
+        atexit(stopGlobalLog);
+    }
+    const char *restorePath = getenv("CACHE_RESTORE");
+    if (restorePath && *restorePath) {
+        printf("error: CACHE_RESTORE can't restore a cache over a loaded program; "
+            "checkpoints don't hold main memory\n");
+        exit(1);
+    }
+    const char *checkpointPath = getenv("CACHE_CHECKPOINT");
+    if (checkpointPath && *checkpointPath) {
+        atexit(checkpointGlobalCache);
+    }
+}
+
+/*
+ * cache_init_config for a hierarchy. The global cache functions then work
+ * on its data L1, except that output, memory, event logs and statistics
+ * cover the whole hierarchy. Capturing a trace needs a single cache.
+ */
+void cache_init_hierarchy(const hierarchyConfig *config)
+{
+    const char *error = cache_hierarchy_config_error(config);
+    if (error) {
+        printf("error: %s\n", error);
+        exit(1);
+    }
+    destroyGlobalCache();
+    globalHierarchy = cache_hierarchy_create(config, NULL);
+    for (int i = 0; i < cache_hierarchy_num_caches(globalHierarchy); ++i) {
+        cacheStruct *cache = cache_hierarchy_cache(globalHierarchy, i);
+        cacheConfig shape;
+        cache_config_init(&shape, cache->blockSize, cache->numSets, cache->blocksPerSet);
+        printf("%s cache:\n", cache_hierarchy_cache_name(globalHierarchy, i));
+        printConfig(&shape);
+    }
+    printf("Levels are %s\n", cache_inclusion_name(config->inclusion));
+    globalCache = cache_hierarchy_cache(globalHierarchy, config->splitL1 ? 1 : 0);
+
+    const char *capturePath = getenv("CACHE_TRACE");
+    if (capturePath && *capturePath) {
+        printf("warning: CACHE_TRACE needs a single cache; not capturing\n");
+    }
+    const char *eventPath = getenv("CACHE_EVENTS");
+    if (eventPath && *eventPath) {
+        cache_hierarchy_log_start(globalHierarchy, eventPath);
+        atexit(stopGlobalLog);
+    }
+}
+
+/*
+ * Set up the cache with given command line parameters. This is
+ * called once in main(). You must implement this function.
+ * Other settings come from the environment; see cache_config_from_env.
+ */
+void cache_init(int blockSize, int numSets, int blocksPerSet)
+{
+    cacheConfig config;
+    cache_config_init(&config, blockSize, numSets, blocksPerSet);
+    cache_config_from_env(&config);
+    hierarchyConfig hierarchy;
+    cache_hierarchy_config_init(&hierarchy, &config);
+    cache_hierarchy_config_from_env(&hierarchy);
+    if (hierarchy.numLevels > 1 || hierarchy.splitL1) {
+        cache_init_hierarchy(&hierarchy);
+    } else {
+        cache_init_config(&config);
+    }
+    // void
+    return;
+}
+
+void cache_set_output(enum outputMode mode)
+{
+    if (globalHierarchy) {
+        cache_hierarchy_set_output(globalHierarchy, mode);
+    } else {
+        cache_handle_set_output(globalCache, mode);
+    }
+}
+
+void cache_set_memory(const cacheMemory *memory)
+{
+    if (globalHierarchy) {
+        cache_hierarchy_set_memory(globalHierarchy, memory);
+    } else {
+        cache_handle_set_memory(globalCache, memory);
+    }
+}
+
+void cache_get_stats(cacheStats *stats)
+{
+    cache_handle_stats(globalCache, stats);
+}
+
+void cache_capture_start(const char *path)
+{
+    cache_handle_capture_start(globalCache, path);
+}
+
+void cache_capture_stop(void)
+{
+    stopGlobalCapture();
+}
+
+void cache_log_start(const char *path)
+{
+    if (globalHierarchy) {
+        cache_hierarchy_log_start(globalHierarchy, path);
+    } else {
+        cache_handle_log_start(globalCache, path);
+    }
+}
+
+void cache_log_stop(void)
+{
+    stopGlobalLog();
+}
+
+void cache_checkpoint(const char *path, long long memoryAccesses)
+{
+    if (globalHierarchy) {
+        printf("error: checkpoints need a single cache\n");
+        exit(1);
+    }
+    cache_handle_checkpoint(globalCache, path, memoryAccesses);
+}
+
+void cache_set_warming(int warming)
+{
+    cache_handle_set_warming(globalCache, warming);
+}
+
+void cache_get_counts(sampleCounts *counts)
+{
+    cache_handle_counts(globalCache, counts);
+}
+
+long long cache_restore(const char *path)
+{
+    if (globalHierarchy) {
+        printf("error: checkpoints need a single cache\n");
+        exit(1);
+    }
+    return cache_handle_restore(globalCache, path);
+}
+
+/*
+ * Write out write buffer entry i, a run of stored words at a time, and
+ * remove it from the buffer.
+ */
+static void writeBufferFlush(cacheStruct *cache, int i)
+{
+    writeBuffer *buffer = cache->writeBuffer;
+    int blockSize = cache->blockSize;
+    int line = buffer->lines[i];
+    int *data = buffer->data + (size_t)i * blockSize;
+    unsigned char *valid = buffer->valid + (size_t)i * blockSize;
+    int start = 0;
+    while (start < blockSize) {
+        if (!valid[start]) {
+            ++start;
+            continue;
+        }
+        int end = start + 1;
+        while (end < blockSize && valid[end]) {
+            ++end;
+        }
+        logAction(cache, line + start, end - start, cacheToMemory);
+        memWriteBlock(cache, line + start, data + start, end - start);
+        start = end;
+    }
+    ++cache->stats.bufferDrains;
+
+    // close the gap, keeping the rest oldest first
+    int after = buffer->count - i - 1;
+    memmove(&buffer->lines[i], &buffer->lines[i + 1], (size_t)after * sizeof(int));
+    memmove(data, data + blockSize, (size_t)after * blockSize * sizeof(int));
+    memmove(valid, valid + blockSize, (size_t)after * blockSize);
+    --buffer->count;
+}
+
+/* Write out the write buffer entries that overlap the size words at addr */
+static void writeBufferDrain(cacheStruct *cache, int addr, int size)
+{
+    writeBuffer *buffer = cache->writeBuffer;
+    int i = 0;
+    while (i < buffer->count) {
+        int line = buffer->lines[i];
+        if (line < addr + size && addr < line + cache->blockSize) {
+            writeBufferFlush(cache, i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+/*
+ * Send a store of size words, all within one line, below the cache:
+ * into the write buffer if there is one, otherwise straight to memory.
+ */
+static void storeBelow(cacheStruct *cache, int addr, const int *data, int size)
+{
+    ++cache->stats.storesBelow;
+    writeBuffer *buffer = cache->writeBuffer;
+    if (!buffer) {
+        logAction(cache, addr, size, cacheToMemory);
+        memWriteBlock(cache, addr, data, size);
+        return;
+    }
+    int blockOffset = getBlockOffset(cache, addr);
+    int line = addr - blockOffset;
+    int entry = 0;
+    while (entry < buffer->count && buffer->lines[entry] != line) {
+        ++entry;
+    }
+    if (entry < buffer->count) {
+        ++cache->stats.coalescedStores;
+    } else {
+        if (buffer->count == buffer->capacity) {
+            ++cache->stats.bufferFullDrains;
+            writeBufferFlush(cache, 0);
+        }
+        entry = buffer->count++;
+        buffer->lines[entry] = line;
+        memset(buffer->valid + (size_t)entry * cache->blockSize, 0, cache->blockSize);
+    }
+    size_t first = (size_t)entry * cache->blockSize + blockOffset;
+    memcpy(buffer->data + first, data, (size_t)size * sizeof(int));
+    memset(buffer->valid + first, 1, size);
+}
+
+/*
+ * Write back or drop line blockIndex before it's replaced or invalidated.
+ * Its tag and data are left as they were.
+ */
+static void evictLine(cacheStruct *cache, int blockIndex){
+            if (cache->tags[blockIndex] == -1) {
+                return; // nothing to evict
+            }
+            PROFILE_EVICT(cache, blockIndex / cache->blocksPerSet);
+            if (cache->prefetched[blockIndex]) {
+                ++cache->stats.unusedPrefetches;
+                cache->prefetched[blockIndex] = 0;
+            }
+            // caclulate the address of the block to evict
+            int evictAddr = getBlockAddr(cache, cache->tags[blockIndex],
+                blockIndex / cache->blocksPerSet);
+            int *data = blockData(cache, blockIndex);
+
+            // an inclusive level first takes back any newer copies above it
+            if (cache->evictHook
+                && cache->evictHook(cache->evictContext, cache, evictAddr, data, cache->blockSize)) {
+                cache->dirty[blockIndex] = 1;
+            }
+
+            // an exclusive level below takes every line, dirty or not
+            if (cache->memory.evictBlock) {
+                if (cache->dirty[blockIndex] == 1) {
+                    ++cache->stats.writebacks;
+                } else {
+                    ++cache->stats.cleanEvictions;
+                }
+                logAction(cache, evictAddr, cache->blockSize, cacheToMemory);
+                memEvictBlock(cache, evictAddr, data, cache->blockSize, cache->dirty[blockIndex]);
+                cache->dirty[blockIndex] = 0;
+                return;
+            }
+
+            // is the block dirty?
+            if (cache->dirty[blockIndex] == 1) {
+                // if so, write blocks to memory
+                memWriteBlock(cache, evictAddr, data, cache->blockSize);
+                 // reset dirty bit
+                cache->dirty[blockIndex] = 0;
+                ++cache->stats.writebacks;
+                // maybe switch thses staments around
+                logAction(cache, evictAddr, cache->blockSize, cacheToMemory);
+
+            } else {
+                // it's valid, so write it to nowhere
+                ++cache->stats.cleanEvictions;
+                logAction(cache, evictAddr, cache->blockSize, cacheToNowhere);
+            }
+}
+
+/* Mark line blockIndex invalid, without writing it anywhere */
+static void invalidateLine(cacheStruct *cache, int blockIndex)
+{
+    if (cache->prefetched[blockIndex]) {
+        ++cache->stats.unusedPrefetches;
+        cache->prefetched[blockIndex] = 0;
+    }
+    cache->tags[blockIndex] = -1;
+    cache->dirty[blockIndex] = 0;
+    cache->shared[blockIndex] = 0;
+    cache->holes = true;
+}
+
+static bool streamTake(cacheStruct *cache, int addr, int *data, int *dirty);
+static int streamForget(cacheStruct *cache, int addr, int size, int *merge);
+
+/*
+ * Write back and invalidate this cache's lines that overlap the size words
+ * at addr; with onlyDirty, leave the clean ones. This keeps split L1 caches
+ * consistent with each other.
+ */
+static void flushLines(cacheStruct *cache, int addr, int size, bool onlyDirty)
+{
+    int first = addr - getBlockOffset(cache, addr);
+    for (int lineAddr = first; lineAddr < addr + size; lineAddr += cache->blockSize) {
+        int setStart = getSetOffset(cache, lineAddr) * cache->blocksPerSet;
+        int blockIndex = findBlock(cache, setStart, getTag(cache, lineAddr));
+        if (blockIndex == -1 || (onlyDirty && !cache->dirty[blockIndex])) {
+            continue;
+        }
+        evictLine(cache, blockIndex);
+        ++cache->stats.invalidations;
+        invalidateLine(cache, blockIndex);
+    }
+    if (cache->streams) {
+        streamForget(cache, addr, size, NULL);
+    }
+    if (cache->writeBuffer) {
+        writeBufferDrain(cache, addr, size);
+    }
+    if (cache->victim) {
+        flushLines(cache->victim, addr, size, onlyDirty);
+    }
+}
+
+
+void writeBlockToCache(cacheStruct *cache, int addr, int tag, int blockIndex, int dirty){
+            PROFILE_BEGIN(start);
+            int memIndex = addr - getBlockOffset(cache, addr);
+            // a line in the victim cache comes out before the evicted line
+            // goes in, which could otherwise push it out
+            bool swap = cache->victim
+                && findBlock(cache->victim, 0, getTag(cache->victim, memIndex)) != -1;
+            if (swap && memReadBlock(cache, memIndex, cache->victimLine, cache->blockSize)) {
+                dirty = 1;
+            }
+
+            // evict the block (it's in the same set as addr)
+            evictLine(cache, blockIndex);
+
+            // update the block
+            if (cache->writeBuffer) {
+                // a stream buffer's copy mustn't miss buffered stores either
+                writeBufferDrain(cache, memIndex, cache->blockSize);
+            }
+            if (cache->sibling) {
+                // the other L1 may have a newer copy
+                flushLines(cache->sibling, memIndex, cache->blockSize, !cache->moveFromSibling);
+            }
+            int *data = blockData(cache, blockIndex);
+            // what we are about to do
+            logAction(cache, memIndex, cache->blockSize, memoryToCache);
+            if (swap) {
+                memcpy(data, cache->victimLine, (size_t)cache->blockSize * sizeof(int));
+            } else if (cache->streams && streamTake(cache, memIndex, data, &dirty)) {
+                // a stream buffer already had it
+            } else {
+                if (memReadBlock(cache, memIndex, data, cache->blockSize)) {
+                    dirty = 1; // the level below gave up its only up-to-date copy
+                }
+                if (cache->streams) {
+                    cache->streamMiss = memIndex;
+                }
+            }
+            // update the block atributes
+            cache->tags[blockIndex] = tag;
+            cache->dirty[blockIndex] = dirty;
+            cache->prefetched[blockIndex] = 0;
+            cache->shared[blockIndex] = 0;
+            PROFILE_END(cache, profileWriteBlock, start);
+}
+
+/*
+ * The block to replace in set setOffset, which starts at line setStart.
+ * Named for the LRU policy the cache started with; it asks whichever
+ * policy is configured.
+ */
+int lruBlock(cacheStruct *cache, int setOffset, int setStart) {
+    PROFILE_BEGIN(start);
+    // a hierarchy may have invalidated lines that the policy still ranks
+    int way = -1;
+    if (cache->holes) {
+        way = firstInvalid(cache, setStart);
+    }
+    if (way == -1) {
+        way = cache->policy->victim(cache, setOffset, setStart);
+    }
+    PROFILE_END(cache, profileLruBlock, start);
+    return setStart + way;
+}
+
+/*
+ * Tell the replacement policy that lruBlockIndex was just used, either by a
+ * hit or by filling it on a miss.
+ */
+void updateLRU(cacheStruct *cache, int setOffset, int setStart, int lruBlockIndex, bool fill){
+    // out of bounds check
+    if (lruBlockIndex < setStart || lruBlockIndex >= setStart + cache->blocksPerSet) {
+        printf("error: lruBlockIndex out of bounds\n");
+        return ;
+    }
+    PROFILE_BEGIN(start);
+    if (fill) {
+        cache->policy->fill(cache, setOffset, setStart, lruBlockIndex - setStart);
+    } else {
+        cache->policy->hit(cache, setOffset, setStart, lruBlockIndex - setStart);
+    }
+    PROFILE_END(cache, profileUpdateLRU, start);
+}
+
+/*
+ * Prefetching. Prefetched lines are flagged until a demand access uses
+ * them, and aren't counted as demand hits or misses; the words they move
+ * are counted in prefetchWords as well as memWords.
+ */
+static int levelAccess(void *context, int addr, int write_flag, int write_data);
+
+/* How many words a cache's memory has, looking through lower levels */
+static int memorySize(const cacheStruct *cache)
+{
+    while (cache->memory.access == levelAccess) {
+        cache = cache->memory.context;
+    }
+    return cache->memory.size;
+}
+
+/* A demand access used line blockIndex. Returns whether it was prefetched. */
+static inline bool usePrefetched(cacheStruct *cache, int blockIndex)
+{
+    if (!cache->prefetched[blockIndex]) {
+        return false;
+    }
+    cache->prefetched[blockIndex] = 0;
+    ++cache->stats.usefulPrefetches;
+    return true;
+}
+
+/* Bring the line holding addr into the cache, unless it's there already */
+static void prefetchBlock(cacheStruct *cache, int addr)
+{
+    if (addr < 0) {
+        return;
+    }
+    int blockAddr = addr - getBlockOffset(cache, addr);
+    if (blockAddr + cache->blockSize > memorySize(cache)) {
+        return;
+    }
+    int setOffset = getSetOffset(cache, addr);
+    int setStart = setOffset * cache->blocksPerSet;
+    int tag = getTag(cache, addr);
+    if (findBlock(cache, setStart, tag) != -1) {
+        return;
+    }
+    long long memWords = cache->stats.memWords;
+    int blockIndex = lruBlock(cache, setOffset, setStart);
+    writeBlockToCache(cache, addr, tag, blockIndex, 0);
+    updateLRU(cache, setOffset, setStart, blockIndex, true);
+    cache->prefetched[blockIndex] = 1;
+    ++cache->stats.prefetches;
+    cache->stats.prefetchWords += cache->stats.memWords - memWords;
+}
+
+/* Whether any stream buffer holds the line at addr */
+static bool streamHolds(const cacheStruct *cache, int addr)
+{
+    for (int i = 0; i < NUM_STREAM_BUFFERS; ++i) {
+        const streamBuffer *stream = &cache->streams[i];
+        for (int j = 0; j < stream->count; ++j) {
+            if (stream->blocks[(stream->head + j) % cache->prefetchDegree] == addr) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* Fetch lines into a stream buffer until it's full */
+static void streamFill(cacheStruct *cache, streamBuffer *stream)
+{
+    int limit = memorySize(cache);
+    while (stream->count < cache->prefetchDegree && stream->next + cache->blockSize <= limit) {
+        if (findBlock(cache, getSetOffset(cache, stream->next) * cache->blocksPerSet,
+                getTag(cache, stream->next)) != -1 || streamHolds(cache, stream->next)) {
+            // there's a copy already; a second one would go stale
+            stream->next += cache->blockSize;
+            continue;
+        }
+        int entry = (stream->head + stream->count) % cache->prefetchDegree;
+        if (cache->sibling) {
+            flushLines(cache->sibling, stream->next, cache->blockSize, !cache->moveFromSibling);
+        }
+        long long memWords = cache->stats.memWords;
+        stream->dirty[entry] = (unsigned char)memReadBlock(cache, stream->next,
+            stream->data + (size_t)entry * cache->blockSize, cache->blockSize);
+        stream->blocks[entry] = stream->next;
+        ++stream->count;
+        stream->next += cache->blockSize;
+        ++cache->stats.prefetches;
+        cache->stats.prefetchWords += cache->stats.memWords - memWords;
+    }
+}
+
+/* Drop the oldest count lines of a stream buffer, writing back dirty ones */
+static void streamDrop(cacheStruct *cache, streamBuffer *stream, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        int entry = stream->head;
+        stream->head = (stream->head + 1) % cache->prefetchDegree;
+        --stream->count;
+        if (stream->blocks[entry] == -1) {
+            continue; // already given up; see streamForget
+        }
+        ++cache->stats.unusedPrefetches;
+        if (stream->dirty[entry]) {
+            const int *data = stream->data + (size_t)entry * cache->blockSize;
+            long long memWords = cache->stats.memWords;
+            if (cache->memory.evictBlock) {
+                memEvictBlock(cache, stream->blocks[entry], data, cache->blockSize, 1);
+            } else {
+                memWriteBlock(cache, stream->blocks[entry], data, cache->blockSize);
+            }
+            cache->stats.prefetchWords += cache->stats.memWords - memWords;
+        }
+    }
+}
+
+/*
+ * On a miss, take the line at addr from a stream buffer if one has it,
+ * skipping over any lines before it, and leave the buffer for
+ * prefetchAfter to top up. Returns whether it did.
+ */
+static bool streamTake(cacheStruct *cache, int addr, int *data, int *dirty)
+{
+    for (int i = 0; i < NUM_STREAM_BUFFERS; ++i) {
+        streamBuffer *stream = &cache->streams[i];
+        for (int j = 0; j < stream->count; ++j) {
+            int entry = (stream->head + j) % cache->prefetchDegree;
+            if (stream->blocks[entry] != addr) {
+                continue;
+            }
+            streamDrop(cache, stream, j);
+            memcpy(data, stream->data + (size_t)entry * cache->blockSize,
+                (size_t)cache->blockSize * sizeof(int));
+            if (stream->dirty[entry]) {
+                *dirty = 1;
+            }
+            stream->head = (stream->head + 1) % cache->prefetchDegree;
+            --stream->count;
+            ++cache->stats.usefulPrefetches;
+            ++cache->stats.bufferHits;
+            stream->lastUse = ++cache->streamClock;
+            cache->refill = stream;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Start a stream after a miss at addr in the least recently used buffer */
+static void streamAllocate(cacheStruct *cache, int addr)
+{
+    streamBuffer *stream = &cache->streams[0];
+    for (int i = 1; i < NUM_STREAM_BUFFERS; ++i) {
+        if (cache->streams[i].lastUse < stream->lastUse) {
+            stream = &cache->streams[i];
+        }
+    }
+    streamDrop(cache, stream, stream->count);
+    stream->head = 0;
+    stream->next = addr + cache->blockSize;
+    stream->lastUse = ++cache->streamClock;
+    streamFill(cache, stream);
+}
+
+/*
+ * Give up any stream buffer lines within the size words at addr, writing
+ * back dirty ones. Given merge, the words at addr, dirty lines are copied
+ * into it instead, as takeLines does; then returns nonzero if there were any.
+ */
+static int streamForget(cacheStruct *cache, int addr, int size, int *merge)
+{
+    int merged = 0;
+    for (int i = 0; i < NUM_STREAM_BUFFERS; ++i) {
+        streamBuffer *stream = &cache->streams[i];
+        for (int j = 0; j < stream->count; ++j) {
+            int entry = (stream->head + j) % cache->prefetchDegree;
+            int block = stream->blocks[entry];
+            if (block == -1 || block + cache->blockSize <= addr || block >= addr + size) {
+                continue;
+            }
+            if (stream->dirty[entry] && merge) {
+                memcpy(merge + (block - addr), stream->data + (size_t)entry * cache->blockSize,
+                    (size_t)cache->blockSize * sizeof(int));
+                merged = 1;
+            } else if (stream->dirty[entry]) {
+                const int *data = stream->data + (size_t)entry * cache->blockSize;
+                if (cache->memory.evictBlock) {
+                    memEvictBlock(cache, block, data, cache->blockSize, 1);
+                } else {
+                    memWriteBlock(cache, block, data, cache->blockSize);
+                }
+            }
+            ++cache->stats.unusedPrefetches;
+            stream->blocks[entry] = -1;
+        }
+    }
+    return merged;
+}
+
+/*
+ * Run the prefetcher after a demand access to addr. trigger says whether
+ * the access missed or was the first use of a prefetched line. Stream
+ * buffers are found on the miss path (see writeBlockToCache) but only
+ * refilled here: a refill can make an inclusive level below evict, and
+ * back-invalidate, the line the access was still using.
+ */
+static void prefetchAfter(cacheStruct *cache, int addr, enum accessKind kind, bool trigger)
+{
+    if (cache->prefetcher == prefetchStream) {
+        if (cache->refill) {
+            streamBuffer *stream = cache->refill;
+            cache->refill = NULL;
+            streamFill(cache, stream);
+        } else if (cache->streamMiss != -1) {
+            int miss = cache->streamMiss;
+            cache->streamMiss = -1;
+            streamAllocate(cache, miss);
+        }
+    } else if (cache->prefetcher == prefetchNextLine) {
+        if (trigger) {
+            int blockAddr = addr - getBlockOffset(cache, addr);
+            for (int i = 1; i <= cache->prefetchDegree; ++i) {
+                prefetchBlock(cache, blockAddr + i * cache->blockSize);
+            }
+        }
+    } else if (cache->prefetcher == prefetchStride) {
+        if (kind == accessFetch) {
+            cache->lastFetch = addr;
+            return;
+        }
+        strideEntry *entry = &cache->strides[(unsigned int)cache->lastFetch % STRIDE_TABLE_SIZE];
+        if (entry->pc != cache->lastFetch) {
+            entry->pc = cache->lastFetch;
+            entry->lastAddr = addr;
+            entry->stride = 0;
+            entry->confidence = 0;
+            return;
+        }
+        int stride = addr - entry->lastAddr;
+        entry->lastAddr = addr;
+        if (stride != entry->stride) {
+            entry->stride = stride;
+            entry->confidence = 0;
+            return;
+        }
+        if (entry->confidence < STRIDE_MAX_CONFIDENCE) {
+            ++entry->confidence;
+        }
+        if (entry->confidence >= STRIDE_CONFIDENT && stride != 0) {
+            for (int i = 1; i <= cache->prefetchDegree; ++i) {
+                prefetchBlock(cache, addr + i * stride);
+            }
+        }
+    }
+}
+
+/*
+ * Tell the shadow cache, if there is one, about an access to the block at
+ * blockAddr, and classify it if the real cache missed.
+ */
+static inline void classifyAccess(cacheStruct *cache, int blockAddr, bool hit)
+{
+    if (!cache->shadow) {
+        return;
+    }
+    enum shadowResult shadowResult = shadowAccess(cache->shadow, blockAddr);
+    if (!hit) {
+        if (shadowResult == shadowFirst) {
+            ++cache->stats.compulsoryMisses;
+        } else if (shadowResult == shadowMiss) {
+            ++cache->stats.capacityMisses;
+        } else {
+            ++cache->stats.conflictMisses;
+        }
+    }
+}
+
+/*
+ * Access one cache. This is cache_access for any instance; see below.
+ */
+int cache_handle_access(cacheStruct *cache, int addr, int write_flag, int write_data){
+    return cache_handle_access_kind(cache, addr, write_flag ? accessStore : accessLoad,
+        write_data);
+}
+
+/*
+ * The counters timeAccess needs to tell what an access did. With a victim
+ * cache, the memory bus is the one below it.
+ */
+typedef struct timingMark
+{
+    long long issue;      // the processor's clock when the access issued
+    long long misses;
+    long long nearbyHits; // misses a stream buffer or victim cache served
+    long long readWords;  // over the memory bus
+    long long writeWords;
+} timingMark;
+
+static const cacheStruct *busSide(const cacheStruct *cache)
+{
+    return cache->victim ? cache->victim : cache;
+}
+
+static void timingMarkNow(const cacheStruct *cache, timingMark *mark)
+{
+    mark->issue = cache->timing->now;
+    mark->misses = cache->stats.misses;
+    mark->nearbyHits = cache->stats.bufferHits + (cache->victim ? cache->victim->stats.hits : 0);
+    mark->readWords = busSide(cache)->stats.memReadWords;
+    mark->writeWords = busSide(cache)->stats.memWriteWords;
+}
+
+/*
+ * Move words over the memory bus, starting no sooner than start. Returns
+ * when the last of them is across.
+ */
+static long long busTransfer(timingState *timing, long long start, long long words)
+{
+    if (!words) {
+        return start;
+    }
+    if (timing->busFree > start) {
+        start = timing->busFree;
+    }
+    timing->busFree = start + (words + timing->bandwidth - 1) / timing->bandwidth;
+    return timing->busFree;
+}
+
+/*
+ * Time the access that has just been made, from the counters it changed
+ * since mark, and advance the processor's clock. Leaves mark's word counts
+ * caught up, for timePrefetches.
+ */
+static void timeAccess(cacheStruct *cache, int addr, enum accessKind kind, timingMark *mark)
+{
+    timingState *timing = cache->timing;
+    long long issue = mark->issue;
+    long long done = issue + timing->hitLatency;
+    long long stall = 0;
+    long long readWords = busSide(cache)->stats.memReadWords - mark->readWords;
+    long long writeWords = busSide(cache)->stats.memWriteWords - mark->writeWords;
+    long long nearbyHits = cache->stats.bufferHits
+        + (cache->victim ? cache->victim->stats.hits : 0) - mark->nearbyHits;
+    int line = addr - getBlockOffset(cache, addr);
+    int inFlight = -1;
+    for (int i = 0; i < timing->numMshrs; ++i) {
+        if (timing->mshrLines[i] == line && timing->mshrReady[i] > issue) {
+            inFlight = i;
+        }
+    }
+    if (inFlight != -1) {
+        // the line is on its way; wait for it rather than fetch it again
+        ++cache->stats.mergedMisses;
+        if (timing->mshrReady[inFlight] > done) {
+            done = timing->mshrReady[inFlight];
+        }
+    } else if (cache->stats.misses != mark->misses && nearbyHits) {
+        done += timing->hitLatency;
+    } else if (cache->stats.misses != mark->misses && readWords) {
+        // a fill from memory, once the tag check has missed and an MSHR is free
+        int mshr = 0;
+        for (int i = 1; i < timing->numMshrs; ++i) {
+            if (timing->mshrReady[i] < timing->mshrReady[mshr]) {
+                mshr = i;
+            }
+        }
+        long long start = issue + timing->hitLatency;
+        if (timing->mshrReady[mshr] > start) {
+            stall = timing->mshrReady[mshr] - start;
+            start = timing->mshrReady[mshr];
+        }
+        cache->stats.mshrStallCycles += stall;
+        done = busTransfer(timing, start + timing->missPenalty, readWords);
+        timing->mshrLines[mshr] = line;
+        timing->mshrReady[mshr] = done;
+    }
+    // a miss that reads nothing wrote around the cache, which takes no
+    // longer than a hit. Writes don't hold up the access, only the bus.
+    busTransfer(timing, issue, writeWords);
+    cache->stats.accessCycles += done - issue;
+    // nothing issues until an instruction fetch completes, even without blocking
+    timing->now = timing->blocking || kind == accessFetch
+        ? done : issue + timing->hitLatency + stall;
+    mark->readWords += readWords;
+    mark->writeWords += writeWords;
+}
+
+/* Put the prefetcher's traffic since mark on the memory bus */
+static void timePrefetches(cacheStruct *cache, const timingMark *mark)
+{
+    timingState *timing = cache->timing;
+    busTransfer(timing, mark->issue + timing->missPenalty,
+        busSide(cache)->stats.memReadWords - mark->readWords);
+    busTransfer(timing, mark->issue, busSide(cache)->stats.memWriteWords - mark->writeWords);
+}
+
+static int demandAccess(cacheStruct *cache, int addr, enum accessKind kind, int write_data,
+    bool *trigger);
+
+/*
+ * Functional warming: an access that only brings the tags, dirty bits and
+ * replacement state up to date, which is all that decides what later
+ * accesses hit, miss or write back. No data moves, and nothing is counted,
+ * logged or sent to memory.
+ */
+static void warmAccess(cacheStruct *cache, int addr, enum accessKind kind)
+{
+    int setOffset = getSetOffset(cache, addr);
+    int setStart = setOffset * cache->blocksPerSet;
+    int tag = getTag(cache, addr);
+    int blockIndex = findBlock(cache, setStart, tag);
+    bool dirty = kind == accessStore && cache->writePolicy == writeBack;
+    if (blockIndex != -1) {
+        cache->dirty[blockIndex] |= dirty;
+        updateLRU(cache, setOffset, setStart, blockIndex, false);
+        return;
+    }
+    if (kind == accessStore && !cache->writeAllocate) {
+        return;
+    }
+    blockIndex = lruBlock(cache, setOffset, setStart);
+    cache->tags[blockIndex] = tag;
+    cache->dirty[blockIndex] = dirty;
+    updateLRU(cache, setOffset, setStart, blockIndex, true);
+}
+
+/*
+ * An access to a cache that samples sets: dropped unless its set is
+ * sampled, and counted against the set if it is.
+ */
+static int sampledAccess(cacheStruct *cache, int addr, enum accessKind kind, int write_data)
+{
+    int set = getSetOffset(cache, addr);
+    if (set % cache->sampleInterval) {
+        ++cache->stats.unsampledAccesses;
+        return 0;
+    }
+    sampleCounts *sample = &cache->samples[set / cache->sampleInterval];
+    long long misses = cache->stats.misses;
+    long long writebacks = cache->stats.writebacks;
+    bool trigger = false;
+    int result = demandAccess(cache, addr, kind, write_data, &trigger);
+    ++sample->accesses;
+    sample->misses += cache->stats.misses - misses;
+    sample->writebacks += cache->stats.writebacks - writebacks;
+    return result;
+}
+
+/*
+ * Access one cache, saying whether a read is an instruction fetch or a lw.
+ */
+int cache_handle_access_kind(cacheStruct *cache, int addr, enum accessKind kind, int write_data){
+    PROFILE_BEGIN(start);
+    if (cache->reuse) {
+        // a property of the accesses, so even warmed and unsampled ones count
+        reuseAccess(cache, addr);
+    }
+    if (cache->warming) {
+        warmAccess(cache, addr, kind);
+        PROFILE_END(cache, profileAccess, start);
+        return 0;
+    }
+    if (cache->capture) {
+        static const enum traceKind traceKinds[] = { traceRead, traceWrite, traceFetch };
+        captureRecord(cache->capture, traceKinds[kind], addr,
+            kind == accessStore ? write_data : 0);
+    }
+    if (cache->samples) {
+        int result = sampledAccess(cache, addr, kind, write_data);
+        PROFILE_END(cache, profileAccess, start);
+        return result;
+    }
+    timingMark mark = { 0, 0, 0, 0, 0 };
+    if (cache->timing) {
+        timingMarkNow(cache, &mark);
+    }
+    bool trigger = false;
+    int result = demandAccess(cache, addr, kind, write_data, &trigger);
+    if (cache->timing) {
+        timeAccess(cache, addr, kind, &mark);
+    }
+    if (cache->prefetcher != prefetchNone) {
+        prefetchAfter(cache, addr, kind, trigger);
+        if (cache->timing) {
+            timePrefetches(cache, &mark);
+        }
+    }
+    PROFILE_END(cache, profileAccess, start);
+    return result;
+}
+
+/*
+ * The access itself, without prefetching. Sets *trigger if the access
+ * should set off the prefetcher: a miss, or the first use of a prefetched
+ * line.
+ */
+static int demandAccess(cacheStruct *cache, int addr, enum accessKind kind, int write_data,
+    bool *trigger){
+    int write_flag = kind == accessStore;
+    if (write_flag && cache->sibling) {
+        // don't leave a stale copy of code that's being overwritten
+        flushLines(cache->sibling, addr - getBlockOffset(cache, addr), cache->blockSize, false);
+    }
+
+    int setOffset = getSetOffset(cache, addr);
+    int tag = getTag(cache, addr);
+    int blockOffset = getBlockOffset(cache, addr);
+
+    // find the block in the set
+    int setStart = setOffset * cache->blocksPerSet;
+
+    // find the block with the matching tag
+    int blockIndex = findBlock(cache, setStart, tag);
+
+    // what a fully associative LRU cache would have done, to classify misses
+    classifyAccess(cache, addr - blockOffset, blockIndex != -1);
+    PROFILE_LOOKUP(cache, setOffset, blockIndex == -1 ? -1 : blockIndex - setStart,
+        cache->blocksPerSet);
+
+    // is lw or sw?
+    if (!write_flag){ // lw
+        bool hit;
+        if (blockIndex != -1) {
+            hit = true; // found a matching tag
+        } else {
+            hit = false; // didn't find a matching tag
+        }
+
+        // if not a hit, find the LRU block
+        if (!hit) {
+            ++cache->stats.misses;
+            ++cache->stats.readMisses;
+            if (kind == accessFetch) {
+                ++cache->stats.fetchMisses;
+            }
+            *trigger = true;
+            int lruBlockIndex = lruBlock(cache, setOffset, setStart);
+
+            // call a function to write the block to the cache
+            writeBlockToCache(cache, addr, tag, lruBlockIndex, 0);
+
+            updateLRU(cache, setOffset, setStart, lruBlockIndex, true);
+
+            logAction(cache, addr, 1, cacheToProcessor);
+            return blockData(cache, lruBlockIndex)[blockOffset];
+        } // end of not hit
+        else{ // hit
+            ++cache->stats.hits;
+            ++cache->stats.readHits;
+            if (kind == accessFetch) {
+                ++cache->stats.fetchHits;
+            }
+            *trigger = usePrefetched(cache, blockIndex);
+            int output = blockData(cache, blockIndex)[blockOffset];
+            // need it before updating the LRU labels
+            updateLRU(cache, setOffset, setStart, blockIndex, false);
+            logAction(cache, addr, 1, cacheToProcessor);
+            return output;
+        }
+    } // end of write flag check
+    else { // sw
+        bool hit;
+        if (blockIndex != -1) {
+            hit = true; // found a matching tag
+        } else {
+            hit = false; // didn't find a matching tag
+        }
+
+        // if not a hit, find the LRU block
+        if (!hit) {
+            ++cache->stats.misses;
+            ++cache->stats.writeMisses;
+            *trigger = true;
+            if (!cache->writeAllocate) {
+                // write around the cache
+                storeBelow(cache, addr, &write_data, 1);
+                return -1;
+            }
+            int lruBlockIndex = lruBlock(cache, setOffset, setStart);
+
+            // write the block to the cache
+            writeBlockToCache(cache, addr, tag, lruBlockIndex, cache->writePolicy == writeBack);
+            logAction(cache, addr, 1, processorToCache);
+            blockData(cache, lruBlockIndex)[blockOffset] = write_data;
+            // now update lru labels
+            updateLRU(cache, setOffset, setStart, lruBlockIndex, true);
+        } // end of not hit
+        else{ // hit
+            ++cache->stats.hits;
+            ++cache->stats.writeHits;
+            *trigger = usePrefetched(cache, blockIndex);
+            // update the block to be dirty
+            if (cache->writePolicy == writeBack) {
+                cache->dirty[blockIndex] = 1;
+            }
+            blockData(cache, blockIndex)[blockOffset] = write_data;
+            logAction(cache, addr, 1, processorToCache);
+            // now update lru labels
+            updateLRU(cache, setOffset, setStart, blockIndex, false);
+
+        }
+        if (cache->writePolicy == writeThrough) {
+            storeBelow(cache, addr, &write_data, 1);
+        }
+        return -1; // always return -1 for sw
+    } // end of sw
+}
+
+/*
+ * Cache hierarchies. Every cache's memory is the cache below it, through
+ * the adapters here, and the last level's is main memory. Lines move
+ * between levels as whole blocks of the upper level's line size, and each
+ * upper line falls within one line below it.
+ */
+struct cacheHierarchy
+{
+    int numCaches;
+    cacheStruct *caches[MAX_CACHE_LEVELS + 1]; // top down: L1I if split, L1 or L1D, L2, ...
+    const char *names[MAX_CACHE_LEVELS + 1];
+    int levels[MAX_CACHE_LEVELS + 1];          // 0 for the L1 caches
+    cacheStruct *fetchCache;                   // L1I if split, otherwise L1
+    cacheStruct *dataCache;                    // L1D if split, otherwise L1
+    enum inclusionPolicy inclusion;
+};
+
+/* Indexed by enum inclusionPolicy */
+static const char *const inclusionNames[] = { "non-inclusive", "inclusive", "exclusive" };
+#define NUM_INCLUSIONS ((int)(sizeof(inclusionNames) / sizeof(inclusionNames[0])))
+
+const char *cache_inclusion_name(enum inclusionPolicy inclusion)
+{
+    return inclusionNames[inclusion];
+}
+
+int cache_inclusion_from_name(const char *name, enum inclusionPolicy *inclusion)
+{
+    for (int i = 0; i < NUM_INCLUSIONS; ++i) {
+        if (!strcmp(name, inclusionNames[i])) {
+            *inclusion = (enum inclusionPolicy)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Read the shape of a cache from "<line size>,<sets>,<lines per set>".
+ * Everything else gets its default. Returns 0 if text isn't in that form.
+ */
+int cache_config_parse(const char *text, cacheConfig *config)
+{
+    long values[3];
+    const char *next = text;
+    for (int i = 0; i < 3; ++i) {
+        char *end;
+        values[i] = strtol(next, &end, 10);
+        if (end == next || *end != (i < 2 ? ',' : '\0')) {
+            return 0;
+        }
+        next = end + 1;
+    }
+    cache_config_init(config, (int)values[0], (int)values[1], (int)values[2]);
+    return 1;
+}
+
+/*
+ * A hierarchy of just l1, non-inclusive, to add levels to.
+ */
+void cache_hierarchy_config_init(hierarchyConfig *config, const cacheConfig *l1)
+{
+    config->numLevels = 1;
+    config->levels[0] = *l1;
+    config->splitL1 = 0;
+    config->l1i = *l1;
+    config->inclusion = inclusionNone;
+}
+
+/*
+ * Check a hierarchy. Returns why it can't be simulated, or NULL if it can.
+ */
+const char *cache_hierarchy_config_error(const hierarchyConfig *config)
+{
+    if (config->numLevels < 1 || config->numLevels > MAX_CACHE_LEVELS) {
+        return "a hierarchy has 1 to 3 levels";
+    }
+    if ((int)config->inclusion < 0 || (int)config->inclusion >= NUM_INCLUSIONS) {
+        return "unknown inclusion policy";
+    }
+    const char *error = config->splitL1 ? cache_config_error(&config->l1i) : NULL;
+    for (int level = 0; !error && level < config->numLevels; ++level) {
+        error = cache_config_error(&config->levels[level]);
+    }
+    if (error) {
+        return error;
+    }
+    // the levels below would only see the sampled sets' misses
+    for (int level = 0; level < config->numLevels; ++level) {
+        if ((config->numLevels > 1 || config->splitL1)
+            && (config->levels[level].sampleInterval > 1
+                || (config->splitL1 && config->l1i.sampleInterval > 1))) {
+            return "set sampling simulates a single cache";
+        }
+    }
+    for (int level = 1; level < config->numLevels; ++level) {
+        int blockSize = config->levels[level].blockSize;
+        if (blockSize % config->levels[level - 1].blockSize != 0
+            || (level == 1 && config->splitL1 && blockSize % config->l1i.blockSize != 0)) {
+            return "each level's line size must be a multiple of the line sizes above it";
+        }
+    }
+    if (config->inclusion == inclusionInclusive) {
+        // back-invalidation only reaches the victim caches of the caches above
+        for (int level = 1; level < config->numLevels; ++level) {
+            if (config->levels[level].victimEntries) {
+                return "inclusive levels below L1 can't have victim caches";
+            }
+        }
+    }
+    if (config->inclusion == inclusionExclusive) {
+        for (int level = 1; level < config->numLevels; ++level) {
+            if (config->levels[level].blockSize != config->levels[0].blockSize) {
+                return "exclusive levels need equal line sizes";
+            }
+        }
+        if (config->splitL1 && config->l1i.blockSize != config->levels[0].blockSize) {
+            return "exclusive levels need equal line sizes";
+        }
+        // a lower level would prefetch lines that L1 already holds
+        for (int level = 1; level < config->numLevels; ++level) {
+            if (config->levels[level].prefetcher != prefetchNone) {
+                return "exclusive levels below L1 can't prefetch";
+            }
+        }
+        // lines move between exclusive levels whole, never a store at a time
+        for (int level = 0; level < config->numLevels; ++level) {
+            const cacheConfig *cache = &config->levels[level];
+            if (cache->writePolicy != writeBack || !cache->writeAllocate) {
+                return "exclusive levels need write-back, write-allocate caches";
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Read or write size words from the level above, all within one line of
+ * this cache. Counted and logged like a single access.
+ */
+static void blockAccess(cacheStruct *cache, int addr, int *readData, const int *writeData,
+    int size)
+{
+    int setOffset = getSetOffset(cache, addr);
+    int tag = getTag(cache, addr);
+    int blockOffset = getBlockOffset(cache, addr);
+    int setStart = setOffset * cache->blocksPerSet;
+    int blockIndex = findBlock(cache, setStart, tag);
+    classifyAccess(cache, addr - blockOffset, blockIndex != -1);
+    PROFILE_LOOKUP(cache, setOffset, blockIndex == -1 ? -1 : blockIndex - setStart,
+        cache->blocksPerSet);
+
+    bool trigger = true;
+    if (blockIndex == -1) {
+        ++cache->stats.misses;
+        if (writeData) {
+            ++cache->stats.writeMisses;
+        } else {
+            ++cache->stats.readMisses;
+        }
+        if (writeData && !cache->writeAllocate) {
+            storeBelow(cache, addr, writeData, size);
+        } else {
+            blockIndex = lruBlock(cache, setOffset, setStart);
+            writeBlockToCache(cache, addr, tag, blockIndex, 0);
+            updateLRU(cache, setOffset, setStart, blockIndex, true);
+        }
+    } else {
+        ++cache->stats.hits;
+        if (writeData) {
+            ++cache->stats.writeHits;
+        } else {
+            ++cache->stats.readHits;
+        }
+        trigger = usePrefetched(cache, blockIndex);
+        updateLRU(cache, setOffset, setStart, blockIndex, false);
+    }
+
+    if (blockIndex == -1) {
+        // written around the cache
+    } else if (writeData) {
+        memcpy(blockData(cache, blockIndex) + blockOffset, writeData, (size_t)size * sizeof(int));
+        logAction(cache, addr, size, processorToCache);
+        if (cache->writePolicy == writeThrough) {
+            storeBelow(cache, addr, writeData, size);
+        } else {
+            cache->dirty[blockIndex] = 1;
+        }
+    } else {
+        memcpy(readData, blockData(cache, blockIndex) + blockOffset, (size_t)size * sizeof(int));
+        logAction(cache, addr, size, cacheToProcessor);
+    }
+    if (cache->prefetcher != prefetchNone) {
+        prefetchAfter(cache, addr, writeData ? accessStore : accessLoad, trigger);
+    }
+}
+
+/* cacheMemory for the level above a cache; the context is the cache */
+static int levelAccess(void *context, int addr, int write_flag, int write_data)
+{
+    return cache_handle_access(context, addr, write_flag, write_data);
+}
+
+static int levelReadBlock(void *context, int addr, int *data, int size)
+{
+    blockAccess(context, addr, data, NULL, size);
+    return 0;
+}
+
+static void levelWriteBlock(void *context, int addr, const int *data, int size)
+{
+    blockAccess(context, addr, NULL, data, size);
+}
+
+/*
+ * Stores that go below a cache with a victim cache (see storeBelow) update
+ * the victim cache's copy of the line, if it has one, and otherwise pass
+ * on to memory
+ */
+static void victimWriteBlock(void *context, int addr, const int *data, int size)
+{
+    cacheStruct *victim = context;
+    if (findBlock(victim, 0, getTag(victim, addr)) != -1) {
+        blockAccess(victim, addr, NULL, data, size);
+    } else {
+        storeBelow(victim, addr, data, size);
+    }
+}
+
+/*
+ * An exclusive level hands a line up when the level above reads it, and
+ * takes back every line the level above evicts.
+ */
+static int exclusiveReadBlock(void *context, int addr, int *data, int size)
+{
+    cacheStruct *cache = context;
+    int setOffset = getSetOffset(cache, addr);
+    int blockOffset = getBlockOffset(cache, addr);
+    int blockIndex = findBlock(cache, setOffset * cache->blocksPerSet, getTag(cache, addr));
+    classifyAccess(cache, addr - blockOffset, blockIndex != -1);
+
+    if (blockIndex == -1) {
+        ++cache->stats.misses;
+        ++cache->stats.readMisses;
+        // go around this level, straight to the one below
+        return memReadBlock(cache, addr, data, size);
+    }
+    ++cache->stats.hits;
+    ++cache->stats.readHits;
+    memcpy(data, blockData(cache, blockIndex) + blockOffset, (size_t)size * sizeof(int));
+    int dirty = cache->dirty[blockIndex];
+    logAction(cache, addr, size, cacheToProcessor);
+    usePrefetched(cache, blockIndex);
+    invalidateLine(cache, blockIndex);
+    return dirty;
+}
+
+static void exclusiveEvictBlock(void *context, int addr, const int *data, int size, int dirty)
+{
+    cacheStruct *cache = context;
+    int setOffset = getSetOffset(cache, addr);
+    int tag = getTag(cache, addr);
+    int setStart = setOffset * cache->blocksPerSet;
+    int blockIndex = findBlock(cache, setStart, tag);
+    bool copy = dirty;
+    if (blockIndex == -1) {
+        blockIndex = lruBlock(cache, setOffset, setStart);
+        evictLine(cache, blockIndex);
+        cache->tags[blockIndex] = tag;
+        cache->dirty[blockIndex] = 0;
+        updateLRU(cache, setOffset, setStart, blockIndex, true);
+        copy = true;
+    } else {
+        // both L1 caches held it, and the other's copy is already here
+        updateLRU(cache, setOffset, setStart, blockIndex, false);
+    }
+    logAction(cache, addr, size, processorToCache);
+    if (copy) {
+        memcpy(blockData(cache, blockIndex) + getBlockOffset(cache, addr), data,
+            (size_t)size * sizeof(int));
+    }
+    if (dirty) {
+        cache->dirty[blockIndex] = 1;
+    }
+}
+
+/*
+ * Remove this cache's lines within the size words at addr, which starts a
+ * line of the level below, and copy the dirty ones into data. Returns
+ * nonzero if there were any.
+ */
+static int takeLines(cacheStruct *cache, int addr, int *data, int size)
+{
+    int merged = 0;
+    for (int lineAddr = addr; lineAddr < addr + size; lineAddr += cache->blockSize) {
+        int setStart = getSetOffset(cache, lineAddr) * cache->blocksPerSet;
+        int blockIndex = findBlock(cache, setStart, getTag(cache, lineAddr));
+        if (blockIndex == -1) {
+            continue;
+        }
+        if (cache->dirty[blockIndex]) {
+            memcpy(data + (lineAddr - addr), blockData(cache, blockIndex),
+                (size_t)cache->blockSize * sizeof(int));
+            merged = 1;
+            ++cache->stats.writebacks;
+            logAction(cache, lineAddr, cache->blockSize, cacheToMemory);
+        } else {
+            logAction(cache, lineAddr, cache->blockSize, cacheToNowhere);
+        }
+        ++cache->stats.invalidations;
+        invalidateLine(cache, blockIndex);
+    }
+    if (cache->streams) {
+        merged |= streamForget(cache, addr, size, data);
+    }
+    if (cache->victim) {
+        merged |= takeLines(cache->victim, addr, data, size);
+    }
+    return merged;
+}
+
+/*
+ * The evictHook of inclusive levels: before cache evicts the line at addr,
+ * invalidate every copy above it, merging dirty ones into data. The nearest
+ * level goes first so the newest copy, the highest one, is merged last.
+ */
+static int backInvalidate(void *context, cacheStruct *cache, int addr, int *data, int size)
+{
+    cacheHierarchy *hierarchy = context;
+    int level = 0;
+    for (int i = 0; i < hierarchy->numCaches; ++i) {
+        if (hierarchy->caches[i] == cache) {
+            level = hierarchy->levels[i];
+        }
+    }
+    int merged = 0;
+    for (int above = level - 1; above >= 0; --above) {
+        for (int i = 0; i < hierarchy->numCaches; ++i) {
+            if (hierarchy->levels[i] == above) {
+                merged |= takeLines(hierarchy->caches[i], addr, data, size);
+            }
+        }
+    }
+    return merged;
+}
+
+/*
+ * Create the caches of a hierarchy. The last level's misses and writebacks
+ * go to memory, or to mem_access if memory is NULL. Every level below L1
+ * starts with outputNone. Returns NULL if the configuration is invalid
+ * (see cache_hierarchy_config_error).
+ */
+cacheHierarchy *cache_hierarchy_create(const hierarchyConfig *config, const cacheMemory *memory)
+{
+    static const char *const levelNames[MAX_CACHE_LEVELS] = { "L1", "L2", "L3" };
+    if (cache_hierarchy_config_error(config)) {
+        return NULL;
+    }
+    cacheHierarchy *hierarchy = malloc(sizeof(cacheHierarchy));
+    if (!hierarchy) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    hierarchy->numCaches = 0;
+    hierarchy->inclusion = config->inclusion;
+    if (config->splitL1) {
+        hierarchy->caches[0] = cache_handle_create(&config->l1i, NULL);
+        hierarchy->names[0] = "L1I";
+        hierarchy->levels[0] = 0;
+        hierarchy->numCaches = 1;
+    }
+    for (int level = 0; level < config->numLevels; ++level) {
+        int index = hierarchy->numCaches++;
+        hierarchy->caches[index] = cache_handle_create(&config->levels[level], NULL);
+        hierarchy->names[index] = config->splitL1 && level == 0 ? "L1D" : levelNames[level];
+        hierarchy->levels[index] = level;
+    }
+    hierarchy->fetchCache = hierarchy->caches[0];
+    hierarchy->dataCache = hierarchy->caches[config->splitL1 ? 1 : 0];
+    if (config->splitL1) {
+        // exclusive levels can't hold a line twice, so copies move between
+        // the L1 caches instead of being shared
+        bool move = config->inclusion == inclusionExclusive;
+        hierarchy->fetchCache->sibling = hierarchy->dataCache;
+        hierarchy->fetchCache->moveFromSibling = move;
+        hierarchy->dataCache->sibling = hierarchy->fetchCache;
+        hierarchy->dataCache->moveFromSibling = move;
+    }
+
+    for (int i = 0; i < hierarchy->numCaches; ++i) {
+        cacheStruct *cache = hierarchy->caches[i];
+        cacheStruct *below = NULL;
+        for (int j = i + 1; j < hierarchy->numCaches; ++j) {
+            if (hierarchy->levels[j] == hierarchy->levels[i] + 1) {
+                below = hierarchy->caches[j];
+                break;
+            }
+        }
+        if (below) {
+            cacheMemory link;
+            link.access = levelAccess;
+            link.readBlock = levelReadBlock;
+            link.writeBlock = levelWriteBlock;
+            link.evictBlock = NULL;
+            link.context = below;
+            link.size = 0; // see memorySize
+            if (config->inclusion == inclusionExclusive) {
+                link.readBlock = exclusiveReadBlock;
+                link.evictBlock = exclusiveEvictBlock;
+            }
+            cache_handle_set_memory(cache, &link);
+        } else {
+            cache_handle_set_memory(cache, memory);
+        }
+        if (hierarchy->levels[i] > 0) {
+            cache_handle_set_output(cache, outputNone);
+            if (config->inclusion == inclusionInclusive) {
+                cache->evictHook = backInvalidate;
+                cache->evictContext = hierarchy;
+            }
+        }
+    }
+    return hierarchy;
+}
+
+/*
+ * Access a hierarchy: fetches go to the instruction L1 and everything else
+ * to the data L1, if L1 is split.
+ */
+int cache_hierarchy_access(cacheHierarchy *hierarchy, int addr, enum accessKind kind,
+    int write_data)
+{
+    cacheStruct *cache = kind == accessFetch ? hierarchy->fetchCache : hierarchy->dataCache;
+    return cache_handle_access_kind(cache, addr, kind, write_data);
+}
+
+int cache_hierarchy_num_caches(const cacheHierarchy *hierarchy)
+{
+    return hierarchy->numCaches;
+}
+
+/* The caches top down: the instruction L1 if split, L1 (or L1D), L2, ... */
+cacheStruct *cache_hierarchy_cache(const cacheHierarchy *hierarchy, int index)
+{
+    return hierarchy->caches[index];
+}
+
+const char *cache_hierarchy_cache_name(const cacheHierarchy *hierarchy, int index)
+{
+    return hierarchy->names[index];
+}
+
+/* Send the last level's misses and writebacks to memory (NULL: mem_access) */
+void cache_hierarchy_set_memory(cacheHierarchy *hierarchy, const cacheMemory *memory)
+{
+    int last = hierarchy->numCaches - 1;
+    for (int i = 0; i < hierarchy->numCaches; ++i) {
+        if (hierarchy->levels[i] == hierarchy->levels[last]) {
+            cache_handle_set_memory(hierarchy->caches[i], memory);
+        }
+    }
+}
+
+/* Select how the L1 caches report their actions; see cache_handle_set_output */
+void cache_hierarchy_set_output(cacheHierarchy *hierarchy, enum outputMode mode)
+{
+    for (int i = 0; i < hierarchy->numCaches; ++i) {
+        if (hierarchy->levels[i] == 0) {
+            cache_handle_set_output(hierarchy->caches[i], mode);
+        }
+    }
+}
+
+/*
+ * Log every cache's actions in binary, each to its own file:
+ * <prefix>.l1i, <prefix>.l1d (or <prefix>.l1), <prefix>.l2 and so on.
+ */
+void cache_hierarchy_log_start(cacheHierarchy *hierarchy, const char *prefix)
+{
+    for (int i = 0; i < hierarchy->numCaches; ++i) {
+        size_t length = strlen(prefix) + strlen(hierarchy->names[i]) + 2;
+        char *path = malloc(length);
+        if (!path) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        snprintf(path, length, "%s.%s", prefix, hierarchy->names[i]);
+        for (char *c = path + strlen(prefix) + 1; *c; ++c) {
+            *c = (char)tolower((unsigned char)*c);
+        }
+        cache_handle_log_start(hierarchy->caches[i], path);
+        free(path);
+    }
+}
+
+void cache_hierarchy_log_stop(cacheHierarchy *hierarchy)
+{
+    for (int i = 0; i < hierarchy->numCaches; ++i) {
+        cache_handle_log_stop(hierarchy->caches[i]);
+    }
+}
+
+/* End of run statistics for each cache, top down */
+void cache_hierarchy_print_stats(const cacheHierarchy *hierarchy)
+{
+    for (int i = 0; i < hierarchy->numCaches; ++i) {
+        printf("%s cache:\n", hierarchy->names[i]);
+        cache_handle_print_stats(hierarchy->caches[i]);
+    }
+}
+
+void cache_hierarchy_destroy(cacheHierarchy *hierarchy)
+{
+    if (!hierarchy) {
+        return;
+    }
+    for (int i = 0; i < hierarchy->numCaches; ++i) {
+        cache_handle_destroy(hierarchy->caches[i]);
+    }
+    free(hierarchy);
+}
+
+/*
+ * Multi-core systems. Each core has a private cache, and the caches stay
+ * coherent with the MESI protocol by snooping each other's lines on a bus
+ * to the shared L2 or memory: a fill takes the line from another cache if
+ * one has it, a load leaves every copy Shared (writing a Modified one back
+ * on the way), and a store invalidates every other copy.
+ *
+ * One bus transaction runs at a time, under the bus lock, and only it
+ * touches other cores' caches, each under that cache's lock. Accesses that
+ * need no transaction, i.e. hits other than stores to Shared lines, only
+ * take their own cache's lock, so cores on different threads run in
+ * parallel until they miss or share.
+ */
 
 /*
- * Returns the number of times mem_access has been called.
+ * The lines another core's store took from a cache, to tell coherence
+ * misses from the others. Open addressing, like the shadow cache's table.
  */
-extern int get_num_mem_accesses(void);
+typedef struct lineSet
+{
+    int *lines;    // -1 if the slot is empty
+    int tableBits; // 0 before the first line goes in
+    int count;
+} lineSet;
+
+/* The bus as seen by one core's cache; this is the cache's memory context */
+typedef struct busPort
+{
+    cacheMulticore *system;
+    int core;
+    bool forStore;   // the transaction in progress is for a store
+    bool sawSharers; // its fill found copies in other caches
+    lineSet lost;
+#ifdef CACHE_THREADS
+    pthread_mutex_t lock; // held while using the core's cache
+#endif
+} busPort;
 
-//Use this when calling printAction. Do not modify the enumerated type below.
-enum actionType
+struct cacheMulticore
 {
-    cacheToProcessor,
-    processorToCache,
-    memoryToCache,
-    cacheToMemory,
-    cacheToNowhere
+    int numCores;
+    cacheStruct *caches[MAX_CORES];
+    busPort ports[MAX_CORES];
+    cacheStruct *l2;    // NULL without one
+    cacheMemory below;  // what the bus reads and writes back to
+#ifdef CACHE_THREADS
+    pthread_mutex_t bus;
+#endif
 };
 
-/* You may add or remove variables from these structs */
-typedef struct blockStruct
+static inline size_t lineSlot(const lineSet *set, int line)
 {
-    int data[MAX_BLOCK_SIZE];
-    int dirty;
-    int lruLabel;
-    int tag;
-    // my added variables (if needed)
-    int offset;
-} blockStruct;
+    return ((unsigned int)line * 2654435769u) >> (32 - set->tableBits);
+}
 
-typedef struct cacheStruct
+static void lineSetAdd(lineSet *set, int line)
 {
-    blockStruct blocks[MAX_CACHE_SIZE];
-    int blockSize;
-    int numSets;
-    int blocksPerSet;
-    // my added variables (if needed)
-} cacheStruct;
+    if (2 * (set->count + 1) > (1 << set->tableBits)) {
+        // double the table, keeping it at most half full
+        int *lines = set->lines;
+        int oldSize = set->tableBits ? 1 << set->tableBits : 0;
+        set->tableBits = set->tableBits ? set->tableBits + 1 : 6;
+        set->lines = malloc(((size_t)1 << set->tableBits) * sizeof(int));
+        if (!set->lines) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        memset(set->lines, -1, ((size_t)1 << set->tableBits) * sizeof(int));
+        set->count = 0;
+        for (int i = 0; i < oldSize; ++i) {
+            if (lines[i] != -1) {
+                lineSetAdd(set, lines[i]);
+            }
+        }
+        free(lines);
+    }
+    size_t mask = ((size_t)1 << set->tableBits) - 1;
+    size_t slot = lineSlot(set, line);
+    while (set->lines[slot] != -1) {
+        if (set->lines[slot] == line) {
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+    set->lines[slot] = line;
+    ++set->count;
+}
 
-/* Global Cache variable */
-cacheStruct cache;
+/* Take line out of set. Returns whether it was there. */
+static bool lineSetRemove(lineSet *set, int line)
+{
+    if (!set->count) {
+        return false;
+    }
+    size_t mask = ((size_t)1 << set->tableBits) - 1;
+    size_t hole = lineSlot(set, line);
+    while (set->lines[hole] != line) {
+        if (set->lines[hole] == -1) {
+            return false;
+        }
+        hole = (hole + 1) & mask;
+    }
+    // shift back the lines after it that would no longer be found
+    for (size_t slot = (hole + 1) & mask; set->lines[slot] != -1; slot = (slot + 1) & mask) {
+        size_t home = lineSlot(set, set->lines[slot]);
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            set->lines[hole] = set->lines[slot];
+            hole = slot;
+        }
+    }
+    set->lines[hole] = -1;
+    --set->count;
+    return true;
+}
 
-void printAction(int, int, enum actionType);
-void printCache(void);
+static inline void portLock(busPort *port)
+{
+#ifdef CACHE_THREADS
+    pthread_mutex_lock(&port->lock);
+#else
+    (void)port;
+#endif
+}
+
+static inline void portUnlock(busPort *port)
+{
+#ifdef CACHE_THREADS
+    pthread_mutex_unlock(&port->lock);
+#else
+    (void)port;
+#endif
+}
+
+/* The line of cache that holds addr, or -1 */
+static inline int findLine(const cacheStruct *cache, int addr)
+{
+    return findBlock(cache, getSetOffset(cache, addr) * cache->blocksPerSet, getTag(cache, addr));
+}
+
+/* Give up a line another core is about to store to */
+static void snoopInvalidate(busPort *port, int blockIndex, int addr)
+{
+    cacheStruct *cache = port->system->caches[port->core];
+    logAction(cache, addr, cache->blockSize, cacheToNowhere);
+    ++cache->stats.snoopInvalidations;
+    invalidateLine(cache, blockIndex);
+    lineSetAdd(&port->lost, addr);
+}
 
 /*
- * Set up the cache with given command line parameters. This is
- * called once in main(). You must implement this function.
+ * A core's cache misses: fill data with the line from another cache if one
+ * has it, and otherwise from below. Returns nonzero if the line comes from
+ * a Modified copy that a store is taking over, so it starts dirty.
  */
-void cache_init(int blockSize, int numSets, int blocksPerSet)
+static int busReadBlock(void *context, int addr, int *data, int size)
 {
-    if (blockSize <= 0 || numSets <= 0 || blocksPerSet <= 0) {
-        printf("error: input parameters must be positive numbers\n");
-        exit(1);
+    busPort *port = context;
+    cacheMulticore *system = port->system;
+    cacheStruct *cache = system->caches[port->core];
+    if (lineSetRemove(&port->lost, addr)) {
+        ++cache->stats.coherenceMisses;
     }
-    if (blocksPerSet * numSets > MAX_CACHE_SIZE) {
-        printf("error: cache must be no larger than %d blocks\n", MAX_CACHE_SIZE);
-        exit(1);
+    bool supplied = false;
+    int dirty = 0;
+    port->sawSharers = false;
+    for (int core = 0; core < system->numCores; ++core) {
+        busPort *peer = &system->ports[core];
+        cacheStruct *other = system->caches[core];
+        if (core == port->core) {
+            continue;
+        }
+        portLock(peer);
+        int blockIndex = findLine(other, addr);
+        if (blockIndex != -1) {
+            if (!supplied) {
+                // every valid copy is up to date
+                memcpy(data, blockData(other, blockIndex), (size_t)size * sizeof(int));
+                supplied = true;
+            }
+            if (port->forStore) {
+                dirty |= other->dirty[blockIndex];
+                snoopInvalidate(peer, blockIndex, addr);
+            } else {
+                if (other->dirty[blockIndex]) {
+                    // Modified becomes Shared, so memory needs the line
+                    ++other->stats.writebacks;
+                    logAction(other, addr, size, cacheToMemory);
+                    memWriteBlock(other, addr, data, size);
+                    other->dirty[blockIndex] = 0;
+                }
+                other->shared[blockIndex] = 1;
+                port->sawSharers = true;
+            }
+        }
+        portUnlock(peer);
     }
-    if (blockSize > MAX_BLOCK_SIZE) {
-        printf("error: blocks must be no larger than %d words\n", MAX_BLOCK_SIZE);
-        exit(1);
+    if (supplied) {
+        ++cache->stats.cacheToCacheTransfers;
+        return dirty;
     }
-    if (!is_power_of_2(blockSize)) {
-        printf("warning: blockSize %d is not a power of 2\n", blockSize);
+    if (system->below.readBlock) {
+        return system->below.readBlock(system->below.context, addr, data, size);
     }
-    if (!is_power_of_2(numSets)) {
-        printf("warning: numSets %d is not a power of 2\n", numSets);
+    for (int i = 0; i < size; ++i) {
+        data[i] = system->below.access(system->below.context, addr + i, 0, 0);
     }
-    printf("Simulating a cache with %d total lines; each line has %d words\n",
-        numSets * blocksPerSet, blockSize);
-    printf("Each set in the cache contains %d lines; there are %d sets\n",
-        blocksPerSet, numSets);
+    return 0;
+}
 
-    cache.blockSize = blockSize;
-    cache.numSets = numSets;
-    cache.blocksPerSet = blocksPerSet;
+static void busWriteBlock(void *context, int addr, const int *data, int size)
+{
+    cacheMulticore *system = ((busPort *)context)->system;
+    if (system->below.writeBlock) {
+        system->below.writeBlock(system->below.context, addr, data, size);
+        return;
+    }
+    for (int i = 0; i < size; ++i) {
+        system->below.access(system->below.context, addr + i, 1, data[i]);
+    }
+}
 
-    // Set all values in the cache blocks to -1
-    for (int i = 0; i < MAX_CACHE_SIZE; ++i) {
-        for (int j = 0; j < blockSize; ++j) {
-            cache.blocks[i].data[j] = -1;
+static int busAccess(void *context, int addr, int write_flag, int write_data)
+{
+    cacheMulticore *system = ((busPort *)context)->system;
+    return system->below.access(system->below.context, addr, write_flag, write_data);
+}
+
+/* A store to a Shared line: invalidate every other copy */
+static void busUpgrade(busPort *port, int addr)
+{
+    cacheMulticore *system = port->system;
+    addr -= getBlockOffset(system->caches[port->core], addr);
+    for (int core = 0; core < system->numCores; ++core) {
+        busPort *peer = &system->ports[core];
+        if (core == port->core) {
+            continue;
+        }
+        portLock(peer);
+        int blockIndex = findLine(system->caches[core], addr);
+        if (blockIndex != -1) {
+            snoopInvalidate(peer, blockIndex, addr);
         }
-        cache.blocks[i].dirty = 0;
-        cache.blocks[i].lruLabel = cache.blocksPerSet - 1 - (i % cache.blocksPerSet);
-        cache.blocks[i].tag = -1;
-        cache.blocks[i].offset = -1;
+        portUnlock(peer);
     }
-    // void
-    return;
+    ++system->caches[port->core]->stats.upgrades;
 }
 
-int getBlockOffset(int addr) {
-    int mask = 0;
-    // find the block offset
-    for (int i = 0; i < (int)log2(cache.blockSize); ++i) {
-        mask = mask << 1;
-        mask = mask | 1;
+/*
+ * numCores cores with l1 caches straight onto memory.
+ */
+void cache_multicore_config_init(multicoreConfig *config, int numCores, const cacheConfig *l1)
+{
+    config->numCores = numCores;
+    config->l1 = *l1;
+    config->sharedL2 = 0;
+    config->l2 = *l1;
+}
+
+/*
+ * Check a multi-core system. Returns why it can't be simulated, or NULL if
+ * it can.
+ */
+const char *cache_multicore_config_error(const multicoreConfig *config)
+{
+    if (config->numCores < 1 || config->numCores > MAX_CORES) {
+        return "a multi-core system has 1 to 64 cores";
+    }
+    const char *error = cache_config_error(&config->l1);
+    if (!error && config->sharedL2) {
+        error = cache_config_error(&config->l2);
     }
-    return addr & mask;
+    if (error) {
+        return error;
+    }
+    // every store has to find its line in the cache to claim it
+    if (config->l1.writePolicy != writeBack || !config->l1.writeAllocate) {
+        return "coherent caches need write-back, write-allocate";
+    }
+    // lines outside the cache proper would escape snooping
+    if (config->l1.prefetcher != prefetchNone || config->l1.victimEntries) {
+        return "coherent caches can't prefetch or have victim caches";
+    }
+    if (config->l1.sampleInterval > 1 || (config->sharedL2 && config->l2.sampleInterval > 1)) {
+        return "set sampling simulates a single cache";
+    }
+    if (config->sharedL2 && config->l2.blockSize % config->l1.blockSize != 0) {
+        return "each level's line size must be a multiple of the line sizes above it";
+    }
+    return NULL;
 }
 
-int getSetOffset(int addr) {
-    int mask = 0;
-    // find the set offset
-    for (int i = 0; i < (int)log2(cache.numSets); ++i) {
-        mask = mask << 1;
-        mask = mask | 1;
+/*
+ * Create the caches of a multi-core system. The bus's misses and
+ * writebacks go to the shared L2, if any, and then to memory, or to
+ * mem_access if memory is NULL. Every cache starts with outputNone.
+ * Returns NULL if the configuration is invalid (see
+ * cache_multicore_config_error).
+ */
+cacheMulticore *cache_multicore_create(const multicoreConfig *config, const cacheMemory *memory)
+{
+    if (cache_multicore_config_error(config)) {
+        return NULL;
+    }
+    cacheMulticore *system = malloc(sizeof(cacheMulticore));
+    if (!system) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    system->numCores = config->numCores;
+    system->l2 = NULL;
+    if (config->sharedL2) {
+        system->l2 = cache_handle_create(&config->l2, memory);
+        cache_handle_set_output(system->l2, outputNone);
+        system->below.access = levelAccess;
+        system->below.readBlock = levelReadBlock;
+        system->below.writeBlock = levelWriteBlock;
+        system->below.evictBlock = NULL;
+        system->below.context = system->l2;
+        system->below.size = memorySize(system->l2);
+    } else if (memory) {
+        system->below = *memory;
+    } else {
+        system->below.access = globalMemAccess;
+        system->below.readBlock = NULL;
+        system->below.writeBlock = NULL;
+        system->below.evictBlock = NULL;
+        system->below.context = NULL;
+        system->below.size = LC2K_MEMORY_WORDS;
     }
-    return (addr >> (int)log2(cache.blockSize)) & mask;
+#ifdef CACHE_THREADS
+    pthread_mutex_init(&system->bus, NULL);
+#endif
+    for (int core = 0; core < system->numCores; ++core) {
+        busPort *port = &system->ports[core];
+        port->system = system;
+        port->core = core;
+        port->forStore = false;
+        port->sawSharers = false;
+        port->lost.lines = NULL;
+        port->lost.tableBits = 0;
+        port->lost.count = 0;
+#ifdef CACHE_THREADS
+        pthread_mutex_init(&port->lock, NULL);
+#endif
+        cacheMemory bus;
+        bus.access = busAccess;
+        bus.readBlock = busReadBlock;
+        bus.writeBlock = busWriteBlock;
+        bus.evictBlock = NULL;
+        bus.context = port;
+        bus.size = system->below.size;
+        system->caches[core] = cache_handle_create(&config->l1, &bus);
+        cache_handle_set_output(system->caches[core], outputNone);
+    }
+    return system;
 }
 
-int lruBlock(setStart) {
-    int lruBlockIndex = -1;
-    for (int i = 0; i < cache.blocksPerSet; ++i) {
-        if (cache.blocks[setStart + i].lruLabel == cache.blocksPerSet - 1) {
-            lruBlockIndex = setStart + i;
-            break;
-        }
+/*
+ * Access core's cache. Each core's accesses must come from one thread at a
+ * time, but different cores' may come from different threads.
+ */
+int cache_multicore_access(cacheMulticore *system, int core, int addr, enum accessKind kind,
+    int write_data)
+{
+    busPort *port = &system->ports[core];
+    cacheStruct *cache = system->caches[core];
+    bool store = kind == accessStore;
+    portLock(port);
+    int blockIndex = findLine(cache, addr);
+    if (blockIndex != -1 && !(store && cache->shared[blockIndex])) {
+        // an Exclusive line silently becomes Modified on a store
+        int result = cache_handle_access_kind(cache, addr, kind, write_data);
+        portUnlock(port);
+        return result;
+    }
+    portUnlock(port);
+
+    // Other cores only touch this cache in bus transactions, so holding the
+    // bus is enough; taking no second cache lock keeps lock order simple.
+#ifdef CACHE_THREADS
+    pthread_mutex_lock(&system->bus);
+#endif
+    // another core's store may have taken the line in the meantime
+    blockIndex = findLine(cache, addr);
+    if (blockIndex != -1 && store && cache->shared[blockIndex]) {
+        busUpgrade(port, addr);
+        cache->shared[blockIndex] = 0;
     }
-    return lruBlockIndex;
+    port->forStore = store;
+    port->sawSharers = false;
+    int result = cache_handle_access_kind(cache, addr, kind, write_data);
+    if (blockIndex == -1) {
+        cache->shared[findLine(cache, addr)] = port->sawSharers;
+    }
+#ifdef CACHE_THREADS
+    pthread_mutex_unlock(&system->bus);
+#endif
+    return result;
 }
 
-void writeBlockToCache(int addr, int tag, int blockIndex, int dirty){
-    // caclulate the address of the block to evict
-            int evictAddr = (cache.blocks[blockIndex].tag << ((int)log2(cache.numSets) + (int)log2(cache.blockSize))) 
-            + (cache.blocks[blockIndex].offset << (int)log2(cache.blockSize));
-            // printf("evictAddr = %d\n", evictAddr);
-            // printf("blockIndex = %d\n", blockIndex);
-            // printf("cache.blocks[blockIndex].tag: %d\n", cache.blocks[blockIndex].tag);
-            // printf("cache.blocks[blockIndex].offset: %d\n", cache.blocks[blockIndex].offset);
-            
-            // is the block dirty?
-            if (cache.blocks[blockIndex].dirty == 1) {
-                // if so, write blocks to memory
-                for (int i = 0; i < cache.blockSize; ++i) {
-                    mem_access(evictAddr + i, 1, cache.blocks[blockIndex].data[i]);
-                }
-                 // reset dirty bit
-                cache.blocks[blockIndex].dirty = 0;
-                // maybe switch thses staments around
-                printAction(evictAddr, cache.blockSize, cacheToMemory);
-                
-            } else {
-                // if not, check if it's valid
-                if (cache.blocks[blockIndex].tag != -1) {
-                    // if valid, write it to nowhere
-                    printAction(evictAddr, cache.blockSize, cacheToNowhere);
-                }
-            }
+cacheStruct *cache_multicore_cache(const cacheMulticore *system, int core)
+{
+    return system->caches[core];
+}
 
-            // update the block
-            int memIndex = addr - (addr % cache.blockSize);
-            // printAction(memIndex, cache.blockSize, memoryToCache);
-            // what we are about to do
-            printAction(memIndex, cache.blockSize, memoryToCache);
-            for (int i = 0; i < cache.blockSize; ++i) {
-                cache.blocks[blockIndex].data[i] = mem_access(memIndex + i, 0, 0);
-            }
-            // update the block atributes
-            cache.blocks[blockIndex].tag = tag;
-            cache.blocks[blockIndex].offset = getSetOffset(addr);
-            cache.blocks[blockIndex].dirty = dirty;
+/* The shared L2, or NULL without one */
+cacheStruct *cache_multicore_l2(const cacheMulticore *system)
+{
+    return system->l2;
+}
 
+void cache_multicore_print_stats(const cacheMulticore *system)
+{
+    for (int core = 0; core < system->numCores; ++core) {
+        cacheStats stats;
+        cache_handle_stats(system->caches[core], &stats);
+        printf("core %d cache:\n", core);
+        cache_handle_print_stats(system->caches[core]);
+        printf("coherence misses %lld, cache-to-cache transfers %lld, upgrades %lld, "
+            "lines invalidated by other cores %lld\n", stats.coherenceMisses,
+            stats.cacheToCacheTransfers, stats.upgrades, stats.snoopInvalidations);
+    }
+    if (system->l2) {
+        printf("L2 cache:\n");
+        cache_handle_print_stats(system->l2);
+    }
 }
 
-void updateLRU(int setStart, int lruBlockIndex){
-    // out of bounds check
-    if (lruBlockIndex < setStart || lruBlockIndex >= setStart + cache.blocksPerSet) {
-        printf("error: lruBlockIndex out of bounds\n");
-        return ;
+void cache_multicore_destroy(cacheMulticore *system)
+{
+    if (!system) {
+        return;
     }
-    // update the LRU labels
-    // hold the current LRU label
-    int lruLabel = cache.blocks[lruBlockIndex].lruLabel;
-    // update the LRU label of the block we just updated
-    cache.blocks[lruBlockIndex].lruLabel = 0;
-    // increment the LRU label of all other blocks
-    for (int i = 0; i < cache.blocksPerSet; ++i) {
-        if ((i + setStart) != lruBlockIndex && cache.blocks[setStart + i].lruLabel < lruLabel) {
-            cache.blocks[setStart + i].lruLabel++;
-        }
+    for (int core = 0; core < system->numCores; ++core) {
+        cache_handle_destroy(system->caches[core]);
+        free(system->ports[core].lost.lines);
+#ifdef CACHE_THREADS
+        pthread_mutex_destroy(&system->ports[core].lock);
+#endif
     }
+    cache_handle_destroy(system->l2);
+#ifdef CACHE_THREADS
+    pthread_mutex_destroy(&system->bus);
+#endif
+    free(system);
 }
 
 /*
@@ -217,100 +4504,188 @@ void updateLRU(int setStart, int lruBlockIndex){
  * write_data is a word, and is only valid if write_flag is 1.
  * The return of mem_access is undefined if write_flag is 1.
  * Thus the return of cache_access is undefined if write_flag is 1.
+ *
+ * Fetches and lw both arrive with write_flag 0. The simulator fetches every
+ * instruction before the instruction touches data, and only lw reads data,
+ * so decoding each fetched instruction tells what the next read is.
  */
-int cache_access(int addr, int write_flag, int write_data){
-    int setOffset = getSetOffset(addr);
-    // annoying math to get the offset and tag
-    int tag = addr >> ((int)log2(cache.blockSize) + (int)log2(cache.numSets));
+#define LC2K_OPCODE_SHIFT 22
+#define LC2K_LW 2
 
-    // find the block in the set
-    int setStart = setOffset * cache.blocksPerSet;
-    
-    // find the block with the matching tag
-    
-    int blockIndex = -1;
-    for (int i = 0; i < cache.blocksPerSet; ++i) {
-        if (cache.blocks[setStart + i].tag == tag) {
-            blockIndex = setStart + i;
-            break;
-        }
-    }
+static enum accessKind nextReadKind = accessFetch;
 
-    // is lw or sw?
-    if (!write_flag){ // lw
-        bool hit;
-        if (blockIndex != -1) {
-            hit = true; // found a matching tag
-        } else {
-            hit = false; // didn't find a matching tag
-        }
+int cache_access(int addr, int write_flag, int write_data){
+    enum accessKind kind = write_flag ? accessStore : nextReadKind;
+    int result = cache_access_kind(addr, kind, write_data);
+    // an lw's data read follows its fetch; anything else is followed by a fetch
+    if (kind == accessFetch && ((result >> LC2K_OPCODE_SHIFT) & 7) == LC2K_LW) {
+        nextReadKind = accessLoad;
+    } else {
+        nextReadKind = accessFetch;
+    }
+    return result;
+}
 
-        // if not a hit, find the LRU block
-        if (!hit) {
-            int lruBlockIndex = lruBlock(setStart);
+/*
+ * cache_access for front-ends that know what kind of access it is.
+ */
+int cache_access_kind(int addr, enum accessKind kind, int write_data){
+    if (globalHierarchy) {
+        return cache_hierarchy_access(globalHierarchy, addr, kind, write_data);
+    }
+    return cache_handle_access_kind(globalCache, addr, kind, write_data);
+}
 
-            // call a function to write the block to the cache
-            writeBlockToCache(addr, tag, lruBlockIndex, 0);
+#ifdef CACHE_PROFILE
+// sets are put in buckets of this many percent by hit rate
+#define PROFILE_HIT_RATE_BUCKET 10
 
-            updateLRU(setStart, lruBlockIndex);
+static void writeCounts(FILE *file, const long long *counts, int count)
+{
+    fputc('[', file);
+    for (int i = 0; i < count; ++i) {
+        fprintf(file, i ? ", %lld" : "%lld", counts[i]);
+    }
+    fputc(']', file);
+}
 
-            printAction(addr, 1, cacheToProcessor);
-            return cache.blocks[lruBlockIndex].data[getBlockOffset(addr)];
-        } // end of not hit
-        else{ // hit
-            int output = cache.blocks[blockIndex].data[getBlockOffset(addr)];
-            // need it before updating the LRU labels
-            updateLRU(setStart, blockIndex);
-            printAction(addr, 1, cacheToProcessor);
-            return output;
+/* One cache's profile, as a JSON object */
+static void writeProfile(FILE *file, const cacheStruct *cache, const char *name)
+{
+    const profileState *profile = cache->profile;
+    fprintf(file, "    {\n      \"name\": \"%s\",\n", name);
+    fprintf(file, "      \"blockSize\": %d, \"numSets\": %d, \"blocksPerSet\": %d,\n",
+        cache->blockSize, cache->numSets, cache->blocksPerSet);
+    fprintf(file, "      \"timers\": {\n");
+    for (int i = 0; i < NUM_PROFILE_TIMERS; ++i) {
+        fprintf(file, "        \"%s\": {\"calls\": %lld, \"ticks\": %lld, \"ticksPerCall\": %.2f}%s\n",
+            profileTimerNames[i], profile->calls[i], profile->ticks[i],
+            profile->calls[i] ? (double)profile->ticks[i] / profile->calls[i] : 0.0,
+            i + 1 < NUM_PROFILE_TIMERS ? "," : "");
+    }
+    fprintf(file, "      },\n      \"tagScanLengths\": ");
+    writeCounts(file, profile->scanLengths, cache->blocksPerSet);
+    // how many sets hit 0-10% of the time, 10-20% and so on; unused sets aside
+    long long buckets[100 / PROFILE_HIT_RATE_BUCKET] = { 0 };
+    long long unused = 0;
+    long long evictions = 0;
+    for (int set = 0; set < cache->numSets; ++set) {
+        long long accesses = profile->setHits[set] + profile->setMisses[set];
+        evictions += profile->setEvictions[set];
+        if (!accesses) {
+            ++unused;
+            continue;
         }
-    } // end of write flag check
-    else { // sw
-        bool hit;
-        if (blockIndex != -1) {
-            hit = true; // found a matching tag
-        } else {
-            hit = false; // didn't find a matching tag
+        int bucket = (int)(100 * profile->setHits[set] / accesses / PROFILE_HIT_RATE_BUCKET);
+        if (bucket == 100 / PROFILE_HIT_RATE_BUCKET) {
+            --bucket; // 100% goes with 90-100%
         }
+        ++buckets[bucket];
+    }
+    fprintf(file, ",\n      \"evictions\": %lld,\n      \"unusedSets\": %lld,\n", evictions,
+        unused);
+    fprintf(file, "      \"setHitRateBucketPercent\": %d,\n      \"setHitRates\": ",
+        PROFILE_HIT_RATE_BUCKET);
+    writeCounts(file, buckets, 100 / PROFILE_HIT_RATE_BUCKET);
+    fprintf(file, ",\n      \"sets\": {\n        \"hits\": ");
+    writeCounts(file, profile->setHits, cache->numSets);
+    fprintf(file, ",\n        \"misses\": ");
+    writeCounts(file, profile->setMisses, cache->numSets);
+    fprintf(file, ",\n        \"evictions\": ");
+    writeCounts(file, profile->setEvictions, cache->numSets);
+    fprintf(file, "\n      }\n    }");
+}
 
-        // if not a hit, find the LRU block
-        if (!hit) {
-            int lruBlockIndex = lruBlock(setStart);
+struct cacheProfileFile
+{
+    FILE *file;
+    int numCaches;
+};
+#endif
 
-            // write the block to the cache
-            writeBlockToCache(addr, tag, lruBlockIndex, 1);
-            // printf("test\n");
-            printAction(addr, 1, processorToCache);
-            // printf("test\n");
-            // print out blcok index
-            // printf("blockIndex: %d\n", lruBlockIndex);
-            // print out getBlockOffset(addr)
-            // printf("getBlockOffset(addr): %d\n", getBlockOffset(addr));
-            // print out next line
-            // printf("cache.blocks[blockIndex].data[getBlockOffset(addr)]: %d\n", cache.blocks[blockIndex].data[getBlockOffset(addr)]);
-            // printf("write_data: %d\n", write_data);
-            cache.blocks[lruBlockIndex].data[getBlockOffset(addr)] = write_data;
-            // printf("test after\n");
-            // now update lru labels
-            updateLRU(setOffset, lruBlockIndex);
-        } // end of not hit
-        else{ // hit
-            // update the block to be dirty
-            cache.blocks[blockIndex].dirty = 1;
-            cache.blocks[blockIndex].data[getBlockOffset(addr)] = write_data;
-            printAction(addr, 1, processorToCache);
-            // now update lru labels
-            updateLRU(setOffset, blockIndex);
+/*
+ * Start a JSON file of cache profiles at path, or at CACHE_PROFILE_FILE
+ * (cache-profile.json by default) if path is NULL. Without CACHE_PROFILE
+ * there's nothing to write, so it returns NULL and writes no file.
+ */
+cacheProfileFile *cache_profile_open(const char *path)
+{
+#ifdef CACHE_PROFILE
+    if (!path) {
+        path = getenv("CACHE_PROFILE_FILE");
+    }
+    if (!path || !*path) {
+        path = "cache-profile.json";
+    }
+    cacheProfileFile *profile = malloc(sizeof(cacheProfileFile));
+    if (!profile) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    profile->file = fopen(path, "w");
+    profile->numCaches = 0;
+    if (!profile->file) {
+        printf("warning: can't write profile %s\n", path);
+        free(profile);
+        return NULL;
+    }
+#ifdef PROFILE_TSC
+    fprintf(profile->file, "{\n  \"ticks\": \"tsc\",\n  \"caches\": [\n");
+#else
+    fprintf(profile->file, "{\n  \"ticks\": \"ns\",\n  \"caches\": [\n");
+#endif
+    return profile;
+#else
+    (void)path;
+    return NULL;
+#endif
+}
 
+/* Add a cache's profile to file under name; a NULL file is ignored */
+void cache_handle_profile_write(cacheProfileFile *file, const cacheStruct *cache,
+    const char *name)
+{
+#ifdef CACHE_PROFILE
+    if (file) {
+        if (file->numCaches++) {
+            fprintf(file->file, ",\n");
         }
-        return -1; // always return -1 for sw
-    } // end of sw
-    /* The next line is a placeholder to connect the simulator to
-    memory with no cache. You will remove this line and implement
-    a cache which interfaces between the simulator and memory. */
-    // return mem_access(addr, write_flag, write_data);
+        writeProfile(file->file, cache, name);
+    }
+#else
+    (void)file;
+    (void)cache;
+    (void)name;
+#endif
+}
+
+void cache_profile_close(cacheProfileFile *file)
+{
+#ifdef CACHE_PROFILE
+    if (file) {
+        fprintf(file->file, "\n  ]\n}\n");
+        fclose(file->file);
+        free(file);
+    }
+#else
+    (void)file;
+#endif
 }
 
+/* Profile the global cache, or each cache in its hierarchy */
+static void writeGlobalProfile(void)
+{
+    cacheProfileFile *file = cache_profile_open(NULL);
+    if (globalHierarchy) {
+        for (int i = 0; i < cache_hierarchy_num_caches(globalHierarchy); ++i) {
+            cache_handle_profile_write(file, cache_hierarchy_cache(globalHierarchy, i),
+                cache_hierarchy_cache_name(globalHierarchy, i));
+        }
+    } else if (globalCache) {
+        cache_handle_profile_write(file, globalCache, "L1");
+    }
+    cache_profile_close(file);
+}
 
 /*
  * print end of run statistics like in the spec. **This is not required**,
@@ -321,9 +4696,220 @@ int cache_access(int addr, int write_flag, int write_data){
  */
 void printStats(void)
 {
+    // the run is over, so finish any capture and event log
+    cache_capture_stop();
+    cache_log_stop();
+    writeGlobalProfile();
+    if (globalHierarchy) {
+        cache_hierarchy_print_stats(globalHierarchy);
+    } else if (globalCache) {
+        cache_handle_print_stats(globalCache);
+    }
     return;
 }
 
+/*
+ * End of run statistics for one cache: the summary from the spec, then,
+ * if it classifies misses, the full breakdown.
+ */
+void cache_handle_print_stats(const cacheStruct *cache)
+{
+    cacheStats stats;
+    cache_handle_stats(cache, &stats);
+    cache_handle_print_stats_from(cache, &stats);
+}
+
+/*
+ * The ratio of the samples' misses (or writebacks) to their accesses, and
+ * the half-width of its confidence interval. This is the usual ratio
+ * estimator for cluster samples, with the finite population correction:
+ * the samples are a known fraction of the whole.
+ */
+static double sampleRatio(const sampleCounts *samples, int numSamples, double fraction,
+    bool writebacks, double *halfWidth)
+{
+    long long accesses = 0;
+    long long counted = 0;
+    for (int i = 0; i < numSamples; ++i) {
+        accesses += samples[i].accesses;
+        counted += writebacks ? samples[i].writebacks : samples[i].misses;
+    }
+    *halfWidth = 0;
+    if (!accesses) {
+        return 0;
+    }
+    double ratio = (double)counted / accesses;
+    if (numSamples > 1) {
+        double squares = 0;
+        for (int i = 0; i < numSamples; ++i) {
+            long long count = writebacks ? samples[i].writebacks : samples[i].misses;
+            double residual = count - ratio * samples[i].accesses;
+            squares += residual * residual;
+        }
+        double meanAccesses = (double)accesses / numSamples;
+        double variance = (1 - fraction) * squares / (numSamples - 1)
+            / (numSamples * meanAccesses * meanAccesses);
+        *halfWidth = SAMPLE_CONFIDENCE_Z * sqrt(variance);
+    }
+    return ratio;
+}
+
+/*
+ * Estimate hits, misses and writebacks over accesses in all, from samples
+ * that make up fraction of it, and print them with their confidence
+ * intervals. population says what the estimates are for.
+ */
+void cache_print_estimates(const sampleCounts *samples, int numSamples, double fraction,
+    long long accesses, const char *population)
+{
+    double missWidth;
+    double writebackWidth;
+    double missRate = sampleRatio(samples, numSamples, fraction, false, &missWidth);
+    double writebackRate = sampleRatio(samples, numSamples, fraction, true, &writebackWidth);
+    long long misses = llround(missRate * accesses);
+    printf("estimated for %s: hits %lld, misses %lld, writebacks %lld\n", population,
+        accesses - misses, misses, llround(writebackRate * accesses));
+    printf("miss rate %.2f%% +/- %.2f%%, writebacks per 100 accesses %.2f +/- %.2f "
+        "(95%% confidence)\n", 100 * missRate, 100 * missWidth, 100 * writebackRate,
+        100 * writebackWidth);
+}
+
+/*
+ * A tracker's reuse distance histogram, with what a fully associative LRU
+ * cache big enough for each bucket would hit
+ */
+static void printReuseHistogram(const reuseTracker *tracker, const char *unit)
+{
+    long long reuses = 0;
+    int lastBucket = -1;
+    for (int i = 0; i < REUSE_BUCKETS; ++i) {
+        reuses += tracker->histogram[i];
+        if (tracker->histogram[i]) {
+            lastBucket = i;
+        }
+    }
+    long long accesses = reuses + tracker->firstUses;
+    printf("reuse distance in %s: %lld first uses, %lld distinct\n", unit, tracker->firstUses,
+        (long long)tracker->numKeys);
+    long long hits = 0;
+    for (int i = 0; i <= lastBucket; ++i) {
+        long long low = i ? 1LL << (i - 1) : 0;
+        long long high = i ? (1LL << i) - 1 : 0;
+        hits += tracker->histogram[i];
+        printf("  %lld-%lld: %lld; a fully associative LRU cache with room for %lld hits %.2f%%\n",
+            low, high, tracker->histogram[i], high + 1,
+            accesses ? 100.0 * hits / accesses : 0.0);
+    }
+}
+
+/* Reuse distances and working sets for a cache that profiles them */
+static void printReuseProfile(const cacheStruct *cache)
+{
+    const reuseProfile *reuse = cache->reuse;
+    char unit[64];
+    snprintf(unit, sizeof(unit), "lines of %d words", cache->blockSize);
+    printReuseHistogram(&reuse->lines, unit);
+    printReuseHistogram(&reuse->words, "words");
+    int numWindows = reuse->lines.numWindows + (reuse->windowAccesses > 0);
+    printf("working set in each window of %d accesses (%d windows):\n", reuse->window,
+        numWindows);
+    for (int i = 0; i < numWindows; ++i) {
+        bool current = i == reuse->lines.numWindows;
+        printf("  window %d: %d lines, %d words\n", i,
+            current ? reuse->lines.windowKeys : reuse->lines.workingSets[i],
+            current ? reuse->words.windowKeys : reuse->words.workingSets[i]);
+    }
+}
+
+/* What a cache that samples sets estimates for the whole cache */
+static void printSampleEstimates(const cacheStruct *cache, const cacheStats *stats)
+{
+    int numSamples = (cache->numSets + cache->sampleInterval - 1) / cache->sampleInterval;
+    printf("sampled 1 in %d sets (%d of %d), %lld accesses to the others skipped\n",
+        cache->sampleInterval, numSamples, cache->numSets, stats->unsampledAccesses);
+    cache_print_estimates(cache->samples, numSamples, (double)numSamples / cache->numSets,
+        stats->hits + stats->misses + stats->unsampledAccesses, "all sets");
+}
+
+/*
+ * cache_handle_print_stats with the given counters in place of the cache's
+ * own, e.g. the total of several caches of the same configuration.
+ */
+void cache_handle_print_stats_from(const cacheStruct *cache, const cacheStats *totals)
+{
+    cacheStats stats = *totals;
+    printf("End of run statistics:\n");
+    printf("hits %lld, misses %lld, writebacks %lld\n", stats.hits, stats.misses,
+        stats.writebacks);
+    printf("%lld dirty cache blocks left\n", stats.dirtyLeft);
+    if (cache->samples) {
+        printSampleEstimates(cache, &stats);
+    }
+    if (cache->prefetcher != prefetchNone) {
+        long long covered = stats.usefulPrefetches;
+        long long uncovered = stats.misses - stats.bufferHits;
+        printf("prefetcher %s, degree %d\n", cache_prefetcher_name(cache->prefetcher),
+            cache->prefetchDegree);
+        printf("prefetches %lld, useful %lld, unused %lld, memory words %lld\n",
+            stats.prefetches, stats.usefulPrefetches, stats.unusedPrefetches,
+            stats.prefetchWords);
+        printf("prefetch accuracy %.1f%%, coverage %.1f%%\n",
+            stats.prefetches ? 100.0 * stats.usefulPrefetches / stats.prefetches : 0.0,
+            covered + uncovered ? 100.0 * covered / (covered + uncovered) : 0.0);
+    }
+    if (cache->writePolicy != writeBack || !cache->writeAllocate || cache->writeBuffer) {
+        printf("%s, %s", cache_write_policy_name(cache->writePolicy),
+            cache->writeAllocate ? "write-allocate" : "no-write-allocate");
+        if (cache->writeBuffer) {
+            printf(", write buffer of %d lines", cache->writeBuffer->capacity);
+        }
+        printf("\nmemory words read %lld, written %lld\n", stats.memReadWords,
+            stats.memWriteWords);
+        printf("stores below the cache %lld", stats.storesBelow);
+        if (cache->writeBuffer) {
+            printf(", coalesced %lld, buffer drains %lld (%lld when full), %lld left",
+                stats.coalescedStores, stats.bufferDrains, stats.bufferFullDrains,
+                stats.bufferedLeft);
+        }
+        printf("\n");
+    }
+    if (cache->timing) {
+        const timingState *timing = cache->timing;
+        long long accesses = stats.hits + stats.misses;
+        printf("hit latency %d, miss penalty %d, memory bus %d words/cycle, ", timing->hitLatency,
+            timing->missPenalty, timing->bandwidth);
+        if (timing->blocking) {
+            printf("blocking\n");
+        } else {
+            printf("%d MSHRs\n", timing->numMshrs);
+        }
+        printf("cycles %lld, average memory access time %.2f cycles\n", stats.cycles,
+            accesses ? (double)stats.accessCycles / accesses : 0.0);
+        if (!timing->blocking) {
+            printf("misses merged in flight %lld, cycles waiting for an MSHR %lld\n",
+                stats.mergedMisses, stats.mshrStallCycles);
+        }
+    }
+    if (cache->victim) {
+        printf("victim cache of %d lines:\n", cache->victim->blocksPerSet);
+        cache_handle_print_stats(cache->victim);
+    }
+    if (cache->reuse) {
+        printReuseProfile(cache);
+    }
+    if (!cache->shadow) {
+        return;
+    }
+    printf("reads: hits %lld, misses %lld\n", stats.readHits, stats.readMisses);
+    printf("writes: hits %lld, misses %lld\n", stats.writeHits, stats.writeMisses);
+    printf("fetches: hits %lld, misses %lld\n", stats.fetchHits, stats.fetchMisses);
+    printf("clean evictions %lld\n", stats.cleanEvictions);
+    printf("invalidations %lld\n", stats.invalidations);
+    printf("main memory words moved %lld\n", stats.memWords);
+    printf("misses: compulsory %lld, capacity %lld, conflict %lld\n",
+        stats.compulsoryMisses, stats.capacityMisses, stats.conflictMisses);
+}
+
 /*
  * Log the specifics of each cache action.
  *
@@ -368,18 +4954,23 @@ void printAction(int address, int size, enum actionType type)
  * This is for debugging only and is not graded, so you may
  * modify it, but that is not recommended.
  */
-void printCache(void)
+void cache_handle_print(const cacheStruct *cache)
 {
     printf("\ncache:\n");
-    for (int set = 0; set < cache.numSets; ++set) {
+    for (int set = 0; set < cache->numSets; ++set) {
         printf("\tset %i:\n", set);
-        for (int block = 0; block < cache.blocksPerSet; ++block) {
+        for (int block = 0; block < cache->blocksPerSet; ++block) {
             printf("\t\t[ %i ]: {", block);
-            for (int index = 0; index < cache.blockSize; ++index) {
-                printf(" %i", cache.blocks[set * cache.blocksPerSet + block].data[index]);
+            for (int index = 0; index < cache->blockSize; ++index) {
+                printf(" %i", blockData(cache, set * cache->blocksPerSet + block)[index]);
             }
             printf(" }\n");
         }
     }
     printf("end cache\n");
 }
+
+void printCache(void)
+{
+    cache_handle_print(globalCache);
+}
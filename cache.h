@@ -0,0 +1,361 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Interface to the cache for front-ends other than the LC-2K simulator.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+//Use this when calling printAction. Do not modify the enumerated type below.
+enum actionType
+{
+    cacheToProcessor,
+    processorToCache,
+    memoryToCache,
+    cacheToMemory,
+    cacheToNowhere
+};
+
+/* How cache actions are reported */
+enum outputMode
+{
+    outputText,  // printAction to stdout, as the LC-2K simulator expects
+    outputNone,  // don't report actions at all
+    outputBinary // append them to an event log (see events.h)
+};
+
+/* What the processor is doing; instruction fetches and lw both read */
+enum accessKind
+{
+    accessLoad,  // lw
+    accessStore, // sw
+    accessFetch  // instruction fetch
+};
+
+/* Counters for one run of a cache */
+typedef struct cacheStats
+{
+    long long hits;
+    long long misses;
+    long long writebacks; // dirty lines written back to memory
+    long long memWords;   // words read from or written to main memory
+    long long readHits;
+    long long readMisses;
+    long long writeHits;
+    long long writeMisses;
+    long long fetchHits;      // the reads that were instruction fetches
+    long long fetchMisses;
+    long long cleanEvictions; // valid, clean lines replaced
+    long long dirtyLeft;      // dirty lines still in the cache
+    long long invalidations;  // lines removed to keep a hierarchy consistent
+    // Every miss is one of these, but only when the cache was created with
+    // classifyMisses set; otherwise they stay 0.
+    long long compulsoryMisses; // first touch of the block
+    long long capacityMisses;   // a fully associative LRU cache would miss too
+    long long conflictMisses;   // a fully associative LRU cache would hit
+    // Prefetching. Prefetch fills aren't demand accesses, so they count in
+    // none of the above except memWords and writebacks.
+    long long prefetches;        // lines the prefetcher brought in
+    long long usefulPrefetches;  // of those, the ones a demand access used
+    long long unusedPrefetches;  // of those, the ones dropped without a use
+    long long prefetchWords;     // memory words moved because of prefetches
+    long long bufferHits;        // demand misses served by a stream buffer
+    // Memory traffic by direction; memWords is their sum
+    long long memReadWords;
+    long long memWriteWords;
+    // Stores that went below the cache: through it (write-through), or
+    // around it (a store miss without write-allocate)
+    long long storesBelow;
+    long long coalescedStores;  // of those, merged into a write buffer entry
+    long long bufferDrains;     // write buffer entries written out
+    long long bufferFullDrains; // of those, to make room for a store
+    long long bufferedLeft;     // write buffer entries still waiting
+    // The victim cache's own counters, copied out by cache_handle_stats
+    long long victimHits;
+    long long victimMisses;
+    long long victimWritebacks;
+    long long victimMemWords; // its own memory traffic; memWords is to it
+    // Timing, when the cache models it; in cycles
+    long long cycles;          // from the first access until everything is done
+    long long accessCycles;    // summed over accesses, from issue to completion
+    long long mergedMisses;    // accesses to a line still being filled
+    long long mshrStallCycles; // time misses spent waiting for a free MSHR
+    // Coherence, for the caches of a multi-core system
+    long long coherenceMisses;       // misses on lines another core's store took away
+    long long cacheToCacheTransfers; // fills another core's cache supplied
+    long long upgrades;              // stores to Shared lines, which invalidate the others
+    long long snoopInvalidations;    // lines another core's store took away
+    long long unsampledAccesses; // accesses set sampling dropped
+} cacheStats;
+
+/*
+ * What one sample of a sampled run saw: a set, with set sampling, or a
+ * window of accesses measured between stretches of functional warming
+ */
+typedef struct sampleCounts
+{
+    long long accesses;
+    long long misses;
+    long long writebacks;
+} sampleCounts;
+
+/* How a cache picks the line to replace; names are from cache_policy_name */
+enum replacementPolicy
+{
+    policyLRU,      // "lru": true LRU
+    policyTreePLRU, // "tree-plru": binary tree pseudo-LRU; needs 2^n lines per set
+    policyBitPLRU,  // "bit-plru": one MRU bit per line
+    policyFIFO,     // "fifo"
+    policyRandom,   // "random"
+    policySRRIP,    // "srrip": static re-reference interval prediction
+    policyBRRIP     // "brrip": bimodal re-reference interval prediction
+};
+
+/* Hardware prefetcher; names are from cache_prefetcher_name */
+enum prefetcher
+{
+    prefetchNone,     // "none"
+    prefetchNextLine, // "next-line": the next degree lines after a miss, or
+                      // after the first use of a prefetched line
+    prefetchStride,   // "stride": degree strides ahead of each load or store,
+                      // per PC (the last instruction fetched)
+    prefetchStream    // "stream": stream buffers of degree lines each
+};
+
+/* When stores reach memory; names are from cache_write_policy_name */
+enum writePolicy
+{
+    writeBack,   // "write-back": when the dirty line is replaced
+    writeThrough // "write-through": straight away; lines are never dirty
+};
+
+/* The shape of a cache; set up with cache_config_init */
+typedef struct cacheConfig
+{
+    int blockSize;    // words per line
+    int numSets;
+    int blocksPerSet; // lines per set
+    enum replacementPolicy policy;
+    int classifyMisses; // nonzero to count compulsory/capacity/conflict misses
+    enum prefetcher prefetcher;
+    int prefetchDegree; // how far ahead the prefetcher goes, in lines
+    enum writePolicy writePolicy;
+    int writeAllocate;      // nonzero to fill the line on a store miss
+    int writeBufferEntries; // lines of stores the write buffer holds; 0 for none
+    int victimEntries;      // lines in a fully associative victim cache behind
+                            // this one, which takes every line it evicts; 0 for none
+    // Timing, set with cache_timing_parse; only accesses made through
+    // cache_handle_access_kind are timed
+    int timing;          // nonzero to model time
+    int hitLatency;      // cycles
+    int missPenalty;     // cycles from a miss until memory starts sending the line
+    int memoryBandwidth; // words per cycle between the cache and memory
+    int mshrs;           // misses that can be outstanding at once; 0 for a
+                         // blocking cache
+    // Set sampling: simulate only every sampleInterval-th set and estimate
+    // the rest from them (see cache_handle_print_stats). Accesses to the
+    // other sets are dropped and reads of them return 0, so this is for
+    // trace replay, not for running programs. 1 simulates every set.
+    int sampleInterval;
+    int reuseWindow; // nonzero to profile reuse distances, and working sets
+                     // over windows of this many accesses
+} cacheConfig;
+
+/*
+ * Main memory as seen by one cache: access behaves like mem_access, and is
+ * passed context as its first argument. readBlock and writeBlock, if not
+ * NULL, move size words at once and must count as size accesses; without
+ * them the cache calls access once per word. readBlock returns nonzero if
+ * the words are newer than main memory's, so the line must start dirty.
+ * evictBlock, if not NULL, is given every valid line the cache replaces,
+ * clean or dirty, in place of writeBlock (e.g. an exclusive next level).
+ */
+typedef struct cacheMemory
+{
+    int (*access)(void *context, int addr, int write_flag, int write_data);
+    int (*readBlock)(void *context, int addr, int *data, int size);
+    void (*writeBlock)(void *context, int addr, const int *data, int size);
+    void (*evictBlock)(void *context, int addr, const int *data, int size, int dirty);
+    void *context;
+    int size; // words; prefetchers stay below it
+} cacheMemory;
+
+/*
+ * Handle-based interface. Each cacheStruct is independent, so different
+ * instances may be used on different threads at the same time.
+ */
+typedef struct cacheStruct cacheStruct;
+
+void cache_config_init(cacheConfig *config, int blockSize, int numSets, int blocksPerSet);
+const char *cache_config_error(const cacheConfig *config);
+void cache_config_print(const cacheConfig *config);
+int cache_config_set(const cacheConfig *config, int addr);
+const char *cache_config_set_parallel_error(const cacheConfig *config);
+const char *cache_config_warming_error(const cacheConfig *config);
+const char *cache_policy_name(enum replacementPolicy policy);
+int cache_policy_from_name(const char *name, enum replacementPolicy *policy);
+const char *cache_prefetcher_name(enum prefetcher prefetcher);
+int cache_prefetch_parse(const char *text, cacheConfig *config);
+const char *cache_write_policy_name(enum writePolicy policy);
+int cache_write_parse(const char *text, cacheConfig *config);
+void cache_write_format(const cacheConfig *config, char *text, int size);
+int cache_timing_parse(const char *text, cacheConfig *config);
+cacheStruct *cache_handle_create(const cacheConfig *config, const cacheMemory *memory);
+void cache_handle_set_memory(cacheStruct *cache, const cacheMemory *memory);
+int cache_handle_access(cacheStruct *cache, int addr, int write_flag, int write_data);
+int cache_handle_access_kind(cacheStruct *cache, int addr, enum accessKind kind, int write_data);
+void cache_handle_stats(const cacheStruct *cache, cacheStats *stats);
+void cache_stats_add(cacheStats *total, const cacheStats *stats);
+void cache_handle_set_warming(cacheStruct *cache, int warming);
+void cache_handle_counts(const cacheStruct *cache, sampleCounts *counts);
+void cache_print_estimates(const sampleCounts *samples, int numSamples, double fraction,
+    long long accesses, const char *population);
+void cache_handle_set_output(cacheStruct *cache, enum outputMode mode);
+void cache_handle_capture_start(cacheStruct *cache, const char *path);
+void cache_handle_capture_stop(cacheStruct *cache);
+void cache_handle_log_start(cacheStruct *cache, const char *path);
+void cache_handle_log_stop(cacheStruct *cache);
+long long cache_handle_log_count(const cacheStruct *cache);
+void cache_handle_checkpoint(const cacheStruct *cache, const char *path,
+    long long memoryAccesses);
+long long cache_handle_restore(cacheStruct *cache, const char *path);
+void cache_handle_print(const cacheStruct *cache);
+void cache_handle_print_stats(const cacheStruct *cache);
+void cache_handle_print_stats_from(const cacheStruct *cache, const cacheStats *stats);
+void cache_handle_destroy(cacheStruct *cache);
+
+/*
+ * Profiles of caches built with -DCACHE_PROFILE, as one JSON file. Without
+ * it cache_profile_open returns NULL and the others do nothing with that.
+ */
+typedef struct cacheProfileFile cacheProfileFile;
+
+cacheProfileFile *cache_profile_open(const char *path);
+void cache_handle_profile_write(cacheProfileFile *file, const cacheStruct *cache,
+    const char *name);
+void cache_profile_close(cacheProfileFile *file);
+
+/*
+ * A stack of caches: L1, optionally split into instruction and data caches,
+ * feeding L2 and so on down to memory. Each level's line size must be a
+ * multiple of the line sizes above it.
+ */
+#define MAX_CACHE_LEVELS 3
+
+/* What a level may hold relative to the levels above it */
+enum inclusionPolicy
+{
+    inclusionNone,      // "non-inclusive": fills go through every level
+    inclusionInclusive, // "inclusive": evicting a line evicts it above too
+    inclusionExclusive  // "exclusive": a line is in at most one level; needs
+                        // equal line sizes
+};
+
+typedef struct hierarchyConfig
+{
+    int numLevels;                        // 1 to MAX_CACHE_LEVELS
+    cacheConfig levels[MAX_CACHE_LEVELS]; // levels[0] is L1, the data L1 if split
+    int splitL1;                          // nonzero to fetch through l1i
+    cacheConfig l1i;
+    enum inclusionPolicy inclusion;       // between each level and the next
+} hierarchyConfig;
+
+typedef struct cacheHierarchy cacheHierarchy;
+
+int cache_config_parse(const char *text, cacheConfig *config);
+const char *cache_inclusion_name(enum inclusionPolicy inclusion);
+int cache_inclusion_from_name(const char *name, enum inclusionPolicy *inclusion);
+void cache_hierarchy_config_init(hierarchyConfig *config, const cacheConfig *l1);
+const char *cache_hierarchy_config_error(const hierarchyConfig *config);
+cacheHierarchy *cache_hierarchy_create(const hierarchyConfig *config, const cacheMemory *memory);
+int cache_hierarchy_access(cacheHierarchy *hierarchy, int addr, enum accessKind kind,
+    int write_data);
+int cache_hierarchy_num_caches(const cacheHierarchy *hierarchy);
+cacheStruct *cache_hierarchy_cache(const cacheHierarchy *hierarchy, int index);
+const char *cache_hierarchy_cache_name(const cacheHierarchy *hierarchy, int index);
+void cache_hierarchy_set_memory(cacheHierarchy *hierarchy, const cacheMemory *memory);
+void cache_hierarchy_set_output(cacheHierarchy *hierarchy, enum outputMode mode);
+void cache_hierarchy_log_start(cacheHierarchy *hierarchy, const char *prefix);
+void cache_hierarchy_log_stop(cacheHierarchy *hierarchy);
+void cache_hierarchy_print_stats(const cacheHierarchy *hierarchy);
+void cache_hierarchy_destroy(cacheHierarchy *hierarchy);
+
+/*
+ * Several cores, each with a private cache, kept coherent by snooping on a
+ * bus to an optional shared L2 and then memory. Different cores may be
+ * accessed from different threads at the same time.
+ */
+#define MAX_CORES 64
+
+typedef struct multicoreConfig
+{
+    int numCores;   // 1 to MAX_CORES
+    cacheConfig l1; // each core's cache; write-back and write-allocate
+    int sharedL2;   // nonzero for an L2 between the bus and memory
+    cacheConfig l2; // its line size must be a multiple of l1's
+} multicoreConfig;
+
+typedef struct cacheMulticore cacheMulticore;
+
+void cache_multicore_config_init(multicoreConfig *config, int numCores, const cacheConfig *l1);
+const char *cache_multicore_config_error(const multicoreConfig *config);
+cacheMulticore *cache_multicore_create(const multicoreConfig *config, const cacheMemory *memory);
+int cache_multicore_access(cacheMulticore *system, int core, int addr, enum accessKind kind,
+    int write_data);
+cacheStruct *cache_multicore_cache(const cacheMulticore *system, int core);
+cacheStruct *cache_multicore_l2(const cacheMulticore *system);
+void cache_multicore_print_stats(const cacheMulticore *system);
+void cache_multicore_destroy(cacheMulticore *system);
+
+/*
+ * The same entry points the LC-2K simulator uses. These work on a single
+ * global cache that cache_init creates. See cache.c.
+ */
+void cache_init(int blockSize, int numSets, int blocksPerSet);
+int cache_access(int addr, int write_flag, int write_data);
+void printStats(void);
+void printAction(int address, int size, enum actionType type);
+void printCache(void);
+
+int cache_access_kind(int addr, enum accessKind kind, int write_data);
+
+void cache_config_from_env(cacheConfig *config);
+void cache_hierarchy_config_from_env(hierarchyConfig *config);
+void cache_init_config(const cacheConfig *config);
+void cache_init_hierarchy(const hierarchyConfig *config);
+void cache_set_output(enum outputMode mode);
+void cache_set_memory(const cacheMemory *memory);
+void cache_get_stats(cacheStats *stats);
+
+/* Record every access and the memory traffic it causes to a trace file */
+void cache_capture_start(const char *path);
+void cache_capture_stop(void);
+
+/* Log cache actions in binary to a file instead of printing them */
+void cache_log_start(const char *path);
+void cache_log_stop(void);
+
+/*
+ * Save the cache's state to a file, with the count of main memory accesses
+ * so far, or start from one saved earlier. cache_restore returns the count
+ * it was saved with.
+ */
+void cache_checkpoint(const char *path, long long memoryAccesses);
+long long cache_restore(const char *path);
+
+/*
+ * Warm the cache functionally between measured windows of a sampled run;
+ * see cache_handle_set_warming
+ */
+void cache_set_warming(int warming);
+void cache_get_counts(sampleCounts *counts);
+
+/*
+ * Main memory. The LC-2K simulator provides these; every other front-end
+ * links memory.c instead.
+ */
+int mem_access(int addr, int write_flag, int write_data);
+int get_num_mem_accesses(void);
+
+#endif
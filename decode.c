@@ -0,0 +1,52 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Decode a binary event log (see events.h) back into the
+ * "$$$ transferring word ..." lines printAction would have printed, so a
+ * binary run can still be diffed against a .out.correct file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "events.h"
+
+#define DECODE_BUFFER_RECORDS 65536
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        printf("error: usage: %s <event log>\n", argv[0]);
+        exit(1);
+    }
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        printf("error: can't open event log %s\n", argv[1]);
+        exit(1);
+    }
+
+    eventHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, EVENT_MAGIC, sizeof(EVENT_MAGIC)) != 0) {
+        printf("error: %s is not an event log\n", argv[1]);
+        exit(1);
+    }
+    if (header.version < 1 || header.version > EVENT_VERSION
+        || header.recordSize != sizeof(eventRecord)) {
+        printf("error: %s has unsupported event log version %u\n", argv[1],
+            (unsigned)header.version);
+        exit(1);
+    }
+
+    static eventRecord records[DECODE_BUFFER_RECORDS];
+    size_t count;
+    while ((count = fread(records, sizeof(eventRecord), DECODE_BUFFER_RECORDS, file)) > 0) {
+        for (size_t i = 0; i < count; ++i) {
+            printAction(records[i].address, eventSize(&records[i]), eventType(&records[i]));
+        }
+    }
+    fclose(file);
+    return 0;
+}
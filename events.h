@@ -0,0 +1,57 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Binary cache event log format.
+ *
+ * An event log is an eventHeader followed by eventRecords, all
+ * little-endian, until the end of the file. Each record is one call the
+ * cache would have made to printAction; decode turns them back into the
+ * same text.
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+#include "cache.h"
+
+#define EVENT_MAGIC "C370EVT"
+#define EVENT_VERSION 1
+
+// The low 28 bits of a record's info word hold the size
+#define EVENT_SIZE_BITS 28
+#define EVENT_SIZE_MASK ((1u << EVENT_SIZE_BITS) - 1)
+
+typedef struct eventHeader
+{
+    char magic[8];       // EVENT_MAGIC, NUL terminated
+    uint32_t version;    // EVENT_VERSION of the writer
+    uint32_t recordSize; // sizeof(eventRecord)
+} eventHeader;
+
+typedef struct eventRecord
+{
+    int32_t address; // printAction's address
+    uint32_t info;   // enum actionType in the top 4 bits, size in the rest
+} eventRecord;
+
+static inline eventRecord makeEventRecord(int address, int size, enum actionType type)
+{
+    eventRecord record;
+    record.address = address;
+    record.info = ((uint32_t)type << EVENT_SIZE_BITS) | ((uint32_t)size & EVENT_SIZE_MASK);
+    return record;
+}
+
+static inline int eventSize(const eventRecord *record)
+{
+    return (int)(record->info & EVENT_SIZE_MASK);
+}
+
+static inline enum actionType eventType(const eventRecord *record)
+{
+    return (enum actionType)(record->info >> EVENT_SIZE_BITS);
+}
+
+#endif
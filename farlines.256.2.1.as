@@ -0,0 +1,11 @@
+	lw	0	1	count	// iterations left
+	lw	0	2	neg1	// -1 to add
+loop	lw	0	3	256	// a word 256 words on
+	sw	0	3	512	// and another 256 past that
+	lw	0	4	768
+	add	1	2	1	// iterations--
+	beq	0	1	end	// if none left
+	beq	0	0	loop	// loop
+end	halt
+count	.fill	4
+neg1	.fill	-1
@@ -0,0 +1,184 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * A flat main memory for front-ends that drive the cache without the
+ * LC-2K simulator. Provides the same mem_access/get_num_mem_accesses
+ * the simulator does, plus separate memories for separate cache instances.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "memory.h"
+
+// LC-2K addresses are 16 bits
+#define DEFAULT_MEMORY_WORDS 65536
+
+struct flatMemory
+{
+    int *words;
+    int numWords;
+    long long numAccesses; // long traces move billions of words
+    flatMemory *owner; // the memory whose words these are, or NULL if its own
+};
+
+/* The memory behind mem_access */
+static flatMemory *globalMemory = NULL;
+
+/*
+ * Allocate numWords words of zeroed memory. Traces may address more than
+ * the 64K words an LC-2K machine has, so front-ends size it to the trace.
+ */
+flatMemory *flat_memory_create(int numWords)
+{
+    if (numWords < DEFAULT_MEMORY_WORDS) {
+        numWords = DEFAULT_MEMORY_WORDS;
+    }
+    flatMemory *memory = malloc(sizeof(flatMemory));
+    if (memory) {
+        memory->words = calloc((size_t)numWords, sizeof(int));
+    }
+    if (!memory || !memory->words) {
+        printf("error: can't allocate %d words of memory\n", numWords);
+        exit(1);
+    }
+    memory->numWords = numWords;
+    memory->numAccesses = 0;
+    memory->owner = NULL;
+    return memory;
+}
+
+/*
+ * Another memory with the same words but its own count of accesses, for
+ * threads that each use a separate part of the words. Destroy it before
+ * the memory it shares.
+ */
+flatMemory *flat_memory_share(flatMemory *memory)
+{
+    flatMemory *view = malloc(sizeof(flatMemory));
+    if (!view) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    *view = *memory;
+    view->numAccesses = 0;
+    view->owner = memory;
+    return view;
+}
+
+void flat_memory_destroy(flatMemory *memory)
+{
+    if (memory) {
+        if (!memory->owner) {
+            free(memory->words);
+        }
+        free(memory);
+    }
+}
+
+/* Words read and written so far */
+long long flat_memory_accesses(const flatMemory *memory)
+{
+    return memory->numAccesses;
+}
+
+/* Matches cacheMemory.access, with a flatMemory as the context */
+int flat_memory_access(void *context, int addr, int write_flag, int write_data)
+{
+    flatMemory *memory = context;
+    if (addr < 0 || addr >= memory->numWords) {
+        printf("error: memory address %d out of range\n", addr);
+        exit(1);
+    }
+    ++memory->numAccesses;
+    if (write_flag) {
+        memory->words[addr] = write_data;
+    }
+    return memory->words[addr];
+}
+
+/* Check that the size words from addr are all in memory */
+static void checkRange(const flatMemory *memory, int addr, int size)
+{
+    if (addr < 0 || size > memory->numWords - addr) {
+        printf("error: memory address %d out of range\n", addr < 0 ? addr : memory->numWords);
+        exit(1);
+    }
+}
+
+/* Matches cacheMemory.readBlock: one copy, counted as size accesses */
+int flat_memory_read_block(void *context, int addr, int *data, int size)
+{
+    flatMemory *memory = context;
+    checkRange(memory, addr, size);
+    memory->numAccesses += size;
+    memcpy(data, memory->words + addr, (size_t)size * sizeof(int));
+    return 0; // main memory is never newer than itself
+}
+
+/* Matches cacheMemory.writeBlock */
+void flat_memory_write_block(void *context, int addr, const int *data, int size)
+{
+    flatMemory *memory = context;
+    checkRange(memory, addr, size);
+    memory->numAccesses += size;
+    memcpy(memory->words + addr, data, (size_t)size * sizeof(int));
+}
+
+cacheMemory flat_memory_interface(flatMemory *memory)
+{
+    cacheMemory result;
+    result.access = flat_memory_access;
+    result.readBlock = flat_memory_read_block;
+    result.writeBlock = flat_memory_write_block;
+    result.evictBlock = NULL;
+    result.context = memory;
+    result.size = memory->numWords;
+    return result;
+}
+
+void memory_init(int numWords)
+{
+    flat_memory_destroy(globalMemory);
+    globalMemory = flat_memory_create(numWords);
+}
+
+int mem_access(int addr, int write_flag, int write_data)
+{
+    if (!globalMemory) {
+        memory_init(DEFAULT_MEMORY_WORDS);
+    }
+    return flat_memory_access(globalMemory, addr, write_flag, write_data);
+}
+
+/* The memory behind mem_access, for caches that can move whole lines */
+cacheMemory memory_interface(void)
+{
+    if (!globalMemory) {
+        memory_init(DEFAULT_MEMORY_WORDS);
+    }
+    return flat_memory_interface(globalMemory);
+}
+
+/* The simulator's int count, for cache.c; front-ends print memory_accesses */
+int get_num_mem_accesses(void)
+{
+    return (int)memory_accesses();
+}
+
+/* Words read and written so far through mem_access and memory_interface */
+long long memory_accesses(void)
+{
+    return globalMemory ? globalMemory->numAccesses : 0;
+}
+
+/* Carry on counting from numAccesses, as when a run resumes from a checkpoint */
+void memory_set_accesses(long long numAccesses)
+{
+    if (!globalMemory) {
+        memory_init(DEFAULT_MEMORY_WORDS);
+    }
+    globalMemory->numAccesses = numAccesses;
+}
@@ -0,0 +1,30 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Flat main memory for front-ends (see memory.c).
+ */
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "cache.h"
+
+/* Size the memory behind mem_access */
+void memory_init(int numWords);
+cacheMemory memory_interface(void);
+long long memory_accesses(void);
+void memory_set_accesses(long long numAccesses);
+
+/* A private memory, e.g. for one of several cache instances */
+typedef struct flatMemory flatMemory;
+
+flatMemory *flat_memory_create(int numWords);
+flatMemory *flat_memory_share(flatMemory *memory);
+void flat_memory_destroy(flatMemory *memory);
+long long flat_memory_accesses(const flatMemory *memory);
+int flat_memory_access(void *context, int addr, int write_flag, int write_data);
+int flat_memory_read_block(void *context, int addr, int *data, int size);
+void flat_memory_write_block(void *context, int addr, const int *data, int size);
+cacheMemory flat_memory_interface(flatMemory *memory);
+
+#endif
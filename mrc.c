@@ -0,0 +1,345 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Miss ratio curves from one pass over a trace.
+ *
+ * Each set keeps an LRU stack of every tag it has seen, ordered exactly like
+ * the cache's lruLabels: position 0 is the most recently used tag, and an
+ * access moves its tag to position 0 and pushes the tags above it down by
+ * one, just as updateLRU does. A cache with n lines per set holds precisely
+ * the top n tags of each stack, so an access that finds its tag at position
+ * d hits in every cache with more than d lines per set and misses in the
+ * rest. One pass therefore gives the misses for every associativity.
+ *
+ * Given a largest number of lines per set, only that many tags of each stack
+ * are kept, and a tag found below them is a miss in every cache of
+ * interest. Otherwise the stacks are kept implicitly, as in cache.c's
+ * reuseTouch: each set marks its tags' latest uses in a Fenwick tree over
+ * its accesses, and a tag's position is how many tags were marked after
+ * its last use. Either way an access costs O(log n) or O(max lines per
+ * set), not O(tags seen).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// smallest Fenwick tree a set starts with or is compacted into
+#define MIN_SET_TIMES 16
+
+/* The top tags of one set, most recently used first, when the depth is capped */
+typedef struct lruStack
+{
+    int *tags;
+    int depth;
+} lruStack;
+
+/* One set's accesses, when every tag is kept */
+typedef struct setHistory
+{
+    // Fenwick tree over times 1 to capacity, with the times that are some
+    // tag's latest use marked; markBlocks says whose, or -1
+    int *tree;
+    int *markBlocks;
+    int capacity;
+    int now; // the latest time handed out
+} setHistory;
+
+/*
+ * Every block seen, in an open addressing table, with when it was last used
+ * in its set. Blocks only go in one set, so the block address is the key.
+ */
+typedef struct blockTable
+{
+    int *blocks; // -1 if the slot is empty
+    int *times;
+    int tableBits;
+    int numBlocks;
+} blockTable;
+
+static void *allocate(size_t size)
+{
+    void *result = malloc(size);
+    if (!result) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    return result;
+}
+
+static void tableAlloc(blockTable *table, int tableBits)
+{
+    size_t size = (size_t)1 << tableBits;
+    table->blocks = allocate(size * sizeof(int));
+    table->times = allocate(size * sizeof(int));
+    memset(table->blocks, -1, size * sizeof(int));
+    table->tableBits = tableBits;
+}
+
+/* The slot that holds block, or the empty slot it belongs in */
+static size_t tableSlot(const blockTable *table, int block)
+{
+    size_t mask = ((size_t)1 << table->tableBits) - 1;
+    size_t slot = ((unsigned int)block * 2654435769u) >> (32 - table->tableBits);
+    while (table->blocks[slot] != -1 && table->blocks[slot] != block) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/*
+ * The slot of block, adding it if it's new; *isNew says which. The table
+ * doubles to stay at most half full.
+ */
+static size_t tableFind(blockTable *table, int block, int *isNew)
+{
+    size_t slot = tableSlot(table, block);
+    *isNew = table->blocks[slot] == -1;
+    if (*isNew) {
+        if (2 * (table->numBlocks + 1) > (1 << table->tableBits)) {
+            int *blocks = table->blocks;
+            int *times = table->times;
+            size_t oldSize = (size_t)1 << table->tableBits;
+            tableAlloc(table, table->tableBits + 1);
+            for (size_t i = 0; i < oldSize; ++i) {
+                if (blocks[i] != -1) {
+                    size_t moved = tableSlot(table, blocks[i]);
+                    table->blocks[moved] = blocks[i];
+                    table->times[moved] = times[i];
+                }
+            }
+            free(blocks);
+            free(times);
+            slot = tableSlot(table, block);
+        }
+        table->blocks[slot] = block;
+        ++table->numBlocks;
+    }
+    return slot;
+}
+
+/*
+ * Find tag in a stack kept to maxDepth tags and move it to the top. Returns
+ * the position it was found at (its stack distance), or -1 if it wasn't
+ * there; the bottom tag falls off a full stack to make room.
+ */
+static int touchStack(lruStack *stack, int tag, int maxDepth)
+{
+    int position = -1;
+    for (int i = 0; i < stack->depth; ++i) {
+        if (stack->tags[i] == tag) {
+            position = i;
+            break;
+        }
+    }
+    if (position == -1) {
+        if (!stack->tags) {
+            stack->tags = allocate(maxDepth * sizeof(int));
+        }
+        if (stack->depth < maxDepth) {
+            ++stack->depth;
+        }
+        memmove(stack->tags + 1, stack->tags, (stack->depth - 1) * sizeof(int));
+    } else {
+        memmove(stack->tags + 1, stack->tags, position * sizeof(int));
+    }
+    stack->tags[0] = tag;
+    return position;
+}
+
+static void historyAlloc(setHistory *history, int capacity)
+{
+    history->tree = calloc(capacity + 1, sizeof(int));
+    history->markBlocks = allocate((capacity + 1) * sizeof(int));
+    if (!history->tree) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    history->capacity = capacity;
+}
+
+static int historyMarksTo(const setHistory *history, int time)
+{
+    int count = 0;
+    for (; time > 0; time -= time & -time) {
+        count += history->tree[time];
+    }
+    return count;
+}
+
+static void historyMark(setHistory *history, int time, int change)
+{
+    for (; time <= history->capacity; time += time & -time) {
+        history->tree[time] += change;
+    }
+}
+
+/*
+ * Renumber a set's marked times 1, 2, ... in order, in a tree with room for
+ * as many again, once every time has been handed out.
+ */
+static void historyCompact(setHistory *history, blockTable *table, int numTags)
+{
+    int *tree = history->tree;
+    int *markBlocks = history->markBlocks;
+    int oldNow = history->now;
+    int capacity = 2 * numTags;
+    historyAlloc(history, capacity < MIN_SET_TIMES ? MIN_SET_TIMES : capacity);
+    int time = 0;
+    for (int i = 1; i <= oldNow; ++i) {
+        if (markBlocks[i] != -1) {
+            history->markBlocks[++time] = markBlocks[i];
+            table->times[tableSlot(table, markBlocks[i])] = time;
+            historyMark(history, time, 1);
+        }
+    }
+    history->now = time;
+    free(tree);
+    free(markBlocks);
+}
+
+/*
+ * Use the block in table slot now, in a set that has seen numTags tags
+ * (counting this one). Returns its stack distance, or -1 if isNew.
+ */
+static int touchHistory(setHistory *history, blockTable *table, size_t slot, int isNew,
+    int numTags)
+{
+    if (history->now == history->capacity) {
+        historyCompact(history, table, numTags - isNew);
+    }
+    int position = -1;
+    if (!isNew) {
+        int last = table->times[slot];
+        // every other mark is a tag used since; this one is the latest
+        position = numTags - historyMarksTo(history, last);
+        historyMark(history, last, -1);
+        history->markBlocks[last] = -1;
+    }
+    int time = ++history->now;
+    table->times[slot] = time;
+    history->markBlocks[time] = table->blocks[slot];
+    historyMark(history, time, 1);
+    return position;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4 || argc > 5) {
+        printf("error: usage: %s <trace file> <line size in words> <number of sets> "
+            "[max lines per set]\n", argv[0]);
+        exit(1);
+    }
+    int blockSize = atoi(argv[2]);
+    int numSets = atoi(argv[3]);
+    int maxWays = argc == 5 ? atoi(argv[4]) : 0;
+    if (blockSize <= 0 || numSets <= 0 || maxWays < 0) {
+        printf("error: input parameters must be positive numbers\n");
+        exit(1);
+    }
+
+    traceFile trace;
+    traceOpen(argv[1], &trace);
+
+    // capped stacks if there's a largest number of lines per set, else histories
+    lruStack *stacks = maxWays ? calloc(numSets, sizeof(lruStack)) : NULL;
+    setHistory *histories = maxWays ? NULL : calloc(numSets, sizeof(setHistory));
+    int *setTags = calloc(numSets, sizeof(int)); // distinct tags each set has seen
+    blockTable table;
+    tableAlloc(&table, 10);
+    table.numBlocks = 0;
+    // distances[d] counts accesses found at stack position d
+    long long *distances = NULL;
+    int maxDepth = 0;
+    long long accesses = 0;
+    long long compulsory = 0;
+    if ((!stacks && !histories) || !setTags) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+
+    for (uint64_t i = 0; i < trace.numRecords; ++i) {
+        enum traceKind kind = traceKindOf(&trace.records[i]);
+        if (kind != traceRead && kind != traceWrite && kind != traceFetch) {
+            continue;
+        }
+        int blockAddr = traceAddr(&trace.records[i]) / blockSize;
+        int set = blockAddr % numSets;
+        int isNew;
+        size_t slot = tableFind(&table, blockAddr, &isNew);
+        setTags[set] += isNew;
+        int position;
+        if (stacks) {
+            position = touchStack(&stacks[set], blockAddr / numSets, maxWays);
+        } else {
+            setHistory *history = &histories[set];
+            if (!history->tree) {
+                historyAlloc(history, MIN_SET_TIMES);
+            }
+            position = touchHistory(history, &table, slot, isNew, setTags[set]);
+        }
+        ++accesses;
+        if (isNew) {
+            ++compulsory;
+        } else {
+            if (setTags[set] > maxDepth) {
+                int depth = setTags[set];
+                if (maxWays && depth > maxWays) {
+                    depth = maxWays; // deeper reuses miss in every cache shown
+                }
+                if (depth > maxDepth) {
+                    distances = realloc(distances, depth * sizeof(long long));
+                    if (!distances) {
+                        printf("error: out of memory\n");
+                        exit(1);
+                    }
+                    memset(distances + maxDepth, 0, (depth - maxDepth) * sizeof(long long));
+                    maxDepth = depth;
+                }
+            }
+            if (position != -1) {
+                ++distances[position];
+            }
+        }
+    }
+
+    // past the deepest reuse, only compulsory misses are left
+    int lastWays = maxDepth > 0 ? maxDepth : 1;
+    if (maxWays > 0 && maxWays < lastWays) {
+        lastWays = maxWays;
+    }
+
+    printf("Miss ratio curve for %d sets; each line has %d words\n", numSets, blockSize);
+    printf("%lld accesses, %lld compulsory misses\n", accesses, compulsory);
+    printf("lines per set\ttotal lines\tmisses\tmiss ratio\n");
+    // misses with n lines per set are the compulsory misses plus every reuse at depth >= n
+    long long misses = accesses;
+    for (int ways = 1; ways <= lastWays; ++ways) {
+        if (ways - 1 < maxDepth) {
+            misses -= distances[ways - 1];
+        }
+        printf("%d\t%d\t%lld\t%.6f\n", ways, ways * numSets, misses,
+            accesses ? (double)misses / accesses : 0.0);
+    }
+
+    for (int set = 0; set < numSets; ++set) {
+        if (stacks) {
+            free(stacks[set].tags);
+        } else {
+            free(histories[set].tree);
+            free(histories[set].markBlocks);
+        }
+    }
+    free(stacks);
+    free(histories);
+    free(setTags);
+    free(table.blocks);
+    free(table.times);
+    free(distances);
+    traceClose(&trace);
+    return 0;
+}
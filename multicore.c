@@ -0,0 +1,277 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Multi-core replay: one binary address trace (see trace.h) per core, each
+ * replayed through the core's private cache, with the caches kept coherent
+ * (see cache_multicore_create).
+ *
+ * Every core runs on its own thread. The threads meet at a barrier after
+ * each epoch of trace records, so no core gets more than an epoch ahead of
+ * the others; within an epoch, the order in which cores reach the bus
+ * depends on the host. With -s the cores instead take turns an epoch at a
+ * time on one thread, which repeats exactly.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cache.h"
+#include "memory.h"
+#include "trace.h"
+
+#define DEFAULT_EPOCH 1000
+
+/* pthread_barrier_t isn't everywhere, so the threads meet here instead */
+typedef struct epochBarrier
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int count;      // threads that have arrived this epoch
+    int numThreads;
+    long epoch;
+} epochBarrier;
+
+/* Shared by all the core threads */
+typedef struct multicoreState
+{
+    cacheMulticore *system;
+    traceFile *traces;
+    long epochRecords;
+    long numEpochs;
+    epochBarrier barrier;
+} multicoreState;
+
+typedef struct coreThread
+{
+    multicoreState *state;
+    int core;
+    uint64_t numAccesses;
+} coreThread;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(const char *program)
+{
+    printf("error: usage: %s <line size in words> <number of sets> <lines per set> "
+        "<trace file>... [-l <line size>,<sets>,<lines per set>] [-e epoch] [-p policy]\n"
+        "\t[-t timing] [-s]\n", program);
+    printf("\tone trace per core, up to %d\n", MAX_CORES);
+    printf("\t-l\tadd a shared L2 of this shape between the cores' caches and memory\n");
+    printf("\t-e\ttrace records each core replays between barriers (default %d)\n",
+        DEFAULT_EPOCH);
+    printf("\t-p\treplacement policy: lru (default), tree-plru, bit-plru, fifo, random, "
+        "srrip or brrip\n");
+    printf("\t-t\tmodel time in each core's cache, as replay -t does\n");
+    printf("\t-s\trun the cores in turn on one thread, for results that repeat exactly\n");
+    exit(1);
+}
+
+static void barrierWait(epochBarrier *barrier)
+{
+    pthread_mutex_lock(&barrier->lock);
+    long epoch = barrier->epoch;
+    if (++barrier->count == barrier->numThreads) {
+        barrier->count = 0;
+        ++barrier->epoch;
+        pthread_cond_broadcast(&barrier->changed);
+    } else {
+        while (barrier->epoch == epoch) {
+            pthread_cond_wait(&barrier->changed, &barrier->lock);
+        }
+    }
+    pthread_mutex_unlock(&barrier->lock);
+}
+
+/* Replay one epoch of core's trace. Returns how many accesses it made. */
+static uint64_t runEpoch(cacheMulticore *system, const traceFile *trace, int core, long epoch,
+    long epochRecords)
+{
+    uint64_t first = (uint64_t)epoch * epochRecords;
+    uint64_t last = first + epochRecords;
+    if (last > trace->numRecords) {
+        last = trace->numRecords;
+    }
+    uint64_t numAccesses = 0;
+    for (uint64_t i = first; i < last; ++i) {
+        const traceRecord *record = &trace->records[i];
+        switch (traceKindOf(record)) {
+        case traceRead:
+            cache_multicore_access(system, core, traceAddr(record), accessLoad, 0);
+            ++numAccesses;
+            break;
+        case traceWrite:
+            cache_multicore_access(system, core, traceAddr(record), accessStore, record->data);
+            ++numAccesses;
+            break;
+        case traceFetch:
+            cache_multicore_access(system, core, traceAddr(record), accessFetch, 0);
+            ++numAccesses;
+            break;
+        default:
+            // captured memory traffic belongs to the capturing configuration
+            break;
+        }
+    }
+    return numAccesses;
+}
+
+static void *coreWorker(void *arg)
+{
+    coreThread *thread = arg;
+    multicoreState *state = thread->state;
+    for (long epoch = 0; epoch < state->numEpochs; ++epoch) {
+        thread->numAccesses += runEpoch(state->system, &state->traces[thread->core],
+            thread->core, epoch, state->epochRecords);
+        barrierWait(&state->barrier);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5) {
+        usage(argv[0]);
+    }
+    cacheConfig l1;
+    cache_config_init(&l1, atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
+    const char *paths[MAX_CORES];
+    int numCores = 0;
+    int i = 4;
+    for (; i < argc && argv[i][0] != '-'; ++i) {
+        if (numCores == MAX_CORES) {
+            usage(argv[0]);
+        }
+        paths[numCores++] = argv[i];
+    }
+    if (numCores == 0) {
+        usage(argv[0]);
+    }
+    multicoreConfig config;
+    cache_multicore_config_init(&config, numCores, &l1);
+    long epochRecords = DEFAULT_EPOCH;
+    int serial = 0;
+    for (; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s")) {
+            serial = 1;
+        } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            if (!cache_config_parse(argv[++i], &config.l2)) {
+                usage(argv[0]);
+            }
+            config.sharedL2 = 1;
+        } else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            epochRecords = atol(argv[++i]);
+            if (epochRecords < 1) {
+                usage(argv[0]);
+            }
+        } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            if (!cache_policy_from_name(argv[++i], &config.l1.policy)) {
+                printf("error: unknown replacement policy %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            if (!cache_timing_parse(argv[++i], &config.l1)) {
+                usage(argv[0]);
+            }
+        } else {
+            usage(argv[0]);
+        }
+    }
+    config.l2.policy = config.l1.policy;
+    const char *error = cache_multicore_config_error(&config);
+    if (error) {
+        printf("error: %s\n", error);
+        exit(1);
+    }
+
+    multicoreState state;
+    state.traces = malloc(numCores * sizeof(traceFile));
+    coreThread *threads = malloc(numCores * sizeof(coreThread));
+    pthread_t *ids = malloc(numCores * sizeof(pthread_t));
+    if (!state.traces || !threads || !ids) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    uint32_t maxAddr = 0;
+    uint64_t maxRecords = 0;
+    for (int core = 0; core < numCores; ++core) {
+        traceOpen(paths[core], &state.traces[core]);
+        if (state.traces[core].header.maxAddr > maxAddr) {
+            maxAddr = state.traces[core].header.maxAddr;
+        }
+        if (state.traces[core].numRecords > maxRecords) {
+            maxRecords = state.traces[core].numRecords;
+        }
+    }
+
+    // room for every block any trace touches, in either level's lines
+    int blockSize = config.sharedL2 ? config.l2.blockSize : config.l1.blockSize;
+    flatMemory *memory = flat_memory_create((int)(maxAddr / blockSize + 1) * blockSize);
+    cacheMemory memoryInterface = flat_memory_interface(memory);
+    state.system = cache_multicore_create(&config, &memoryInterface);
+    state.epochRecords = epochRecords;
+    state.numEpochs = (long)((maxRecords + epochRecords - 1) / epochRecords);
+    pthread_mutex_init(&state.barrier.lock, NULL);
+    pthread_cond_init(&state.barrier.changed, NULL);
+    state.barrier.count = 0;
+    state.barrier.numThreads = numCores;
+    state.barrier.epoch = 0;
+
+    double start = now();
+    for (int core = 0; core < numCores; ++core) {
+        threads[core].state = &state;
+        threads[core].core = core;
+        threads[core].numAccesses = 0;
+    }
+    if (serial) {
+        for (long epoch = 0; epoch < state.numEpochs; ++epoch) {
+            for (int core = 0; core < numCores; ++core) {
+                threads[core].numAccesses += runEpoch(state.system, &state.traces[core], core,
+                    epoch, epochRecords);
+            }
+        }
+    } else {
+        for (int core = 0; core < numCores; ++core) {
+            if (pthread_create(&ids[core], NULL, coreWorker, &threads[core])) {
+                printf("error: can't start a core thread\n");
+                exit(1);
+            }
+        }
+        for (int core = 0; core < numCores; ++core) {
+            pthread_join(ids[core], NULL);
+        }
+    }
+    double elapsed = now() - start;
+
+    cache_multicore_print_stats(state.system);
+
+    // keep stdout diffable; timing goes to stderr
+    uint64_t numAccesses = 0;
+    for (int core = 0; core < numCores; ++core) {
+        numAccesses += threads[core].numAccesses;
+    }
+    fprintf(stderr, "replayed %llu accesses on %d cores in %.3f s (%.1f M accesses/s)\n",
+        (unsigned long long)numAccesses, numCores, elapsed,
+        elapsed > 0 ? numAccesses / elapsed / 1e6 : 0.0);
+
+    cache_multicore_destroy(state.system);
+    flat_memory_destroy(memory);
+    for (int core = 0; core < numCores; ++core) {
+        traceClose(&state.traces[core]);
+    }
+    pthread_mutex_destroy(&state.barrier.lock);
+    pthread_cond_destroy(&state.barrier.changed);
+    free(state.traces);
+    free(threads);
+    free(ids);
+    return 0;
+}
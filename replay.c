@@ -0,0 +1,594 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Trace replay: stream a binary address trace (see trace.h) straight into
+ * the cache, without running an LC-2K program.
+ *
+ * With -j, one cache is simulated a range of sets per thread: the trace is
+ * split into a queue of accesses per range, each thread replays its queue
+ * on its own instance, and the counters (and event logs) are put back
+ * together afterwards. Sets of a cache only interact through the settings
+ * cache_config_set_parallel_error rules out, so the result is the same.
+ *
+ * With -F, the trace is sampled in time instead, in the style of SMARTS:
+ * the cache is only warmed functionally (see cache_handle_set_warming)
+ * except for a window of accesses at the end of every interval, which is
+ * simulated in full. The windows' counts give estimates for the whole
+ * trace. Warming keeps the cache in exactly the state full simulation
+ * would, so the only error is from which accesses were measured.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cache.h"
+#include "events.h"
+#include "memory.h"
+#include "trace.h"
+
+/* One thread of a set-parallel replay, and the sets it simulates */
+typedef struct setWorker
+{
+    const cacheConfig *config;
+    traceRecord *queue;          // its accesses, in trace order
+    uint64_t queueLength;
+    flatMemory *memory;          // a view of the shared memory
+    char *eventPath;             // its part of the event log, or NULL
+    unsigned char *eventCounts;  // actions each access in queue logged
+    cacheStruct *cache;
+} setWorker;
+
+/* Where a sampled replay (-F) is, and what its windows saw */
+typedef struct windowSampler
+{
+    long long interval;    // accesses from the start of one window to the next
+    long long window;      // accesses measured at the end of each interval
+    long long position;    // accesses into the current interval
+    sampleCounts start;    // the counters when the current window opened
+    sampleCounts *windows;
+    int numWindows;
+    int capacity;
+} windowSampler;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* config's settings, with shape's line size, sets and lines per set */
+static cacheConfig withShape(const cacheConfig *config, const cacheConfig *shape)
+{
+    cacheConfig result = *config;
+    result.blockSize = shape->blockSize;
+    result.numSets = shape->numSets;
+    result.blocksPerSet = shape->blocksPerSet;
+    return result;
+}
+
+static void usage(const char *program)
+{
+    printf("error: usage: %s <trace file> <line size in words> <number of sets> "
+        "<lines per set> [-q] [-s] [-e event log] [-p policy] [-f prefetcher] [-w writes]\n"
+        "\t[-v victim lines] [-t timing] [-i <line size>,<sets>,<lines per set>] "
+        "[-l <line size>,<sets>,<lines per set>]... "
+        "[-n inclusion] [-j threads]\n\t[-S interval] [-R checkpoint] [-C checkpoint]\n"
+        "\t[-F interval:window] [-r window]\n", program);
+    printf("\t-q\tdon't print cache actions\n");
+    printf("\t-s\tclassify misses and print detailed statistics\n");
+    printf("\t-e\tlog cache actions in binary to a file (see decode) instead of printing\n");
+    printf("\t-p\treplacement policy: lru (default), tree-plru, bit-plru, fifo, random, "
+        "srrip or brrip\n");
+    printf("\t-f\tprefetcher: none (default), next-line, stride or stream, optionally "
+        "followed by :<degree>\n");
+    printf("\t-w\twrite-back (default) or write-through, then +no-allocate to write store "
+        "misses around\n\t\tthe cache and +buffer:<lines> for a write buffer, e.g. "
+        "write-through+buffer:8\n");
+    printf("\t-v\tput a fully associative victim cache of this many lines behind L1\n");
+    printf("\t-t\tmodel time as <hit latency>:<miss penalty>:<words per cycle>, then "
+        ":<MSHRs> for a\n\t\tnon-blocking cache, and print the average memory access time\n");
+    printf("\t-i\tsplit L1: fetches go to an instruction cache of this shape\n");
+    printf("\t-l\tadd a level below the last one (L2, then L3)\n");
+    printf("\t-n\tinclusion policy between levels: non-inclusive (default), inclusive "
+        "or exclusive\n");
+    printf("\t-j\tsimulate the cache's sets in this many ranges on separate threads; "
+        "needs -q or -e\n");
+    printf("\t-S\tsimulate only every interval-th set and estimate the rest, e.g. -S 32\n");
+    printf("\t-F\tsimulate in full only a window of accesses in every interval, given as "
+        "<interval>:<window>,\n\t\twarming the cache functionally in between, and estimate "
+        "the rest\n");
+    printf("\t-r\tprofile reuse distances in lines and words, and the working set in each "
+        "window\n\t\tof this many accesses\n");
+    printf("\t-R\tstart the cache from a checkpoint of the same shape and policy\n");
+    printf("\t-C\tsave the cache's state to a checkpoint after the trace\n");
+    printf("\twith more than one cache, -e logs each to <event log>.<cache>\n");
+    exit(1);
+}
+
+/* Switch between warming and measuring as the next access requires */
+static void samplerBefore(windowSampler *sampler)
+{
+    if (sampler->position == 0 && sampler->window < sampler->interval) {
+        cache_set_warming(1);
+    }
+    if (sampler->position == sampler->interval - sampler->window) {
+        cache_set_warming(0);
+        cache_get_counts(&sampler->start);
+    }
+}
+
+/* Record the window that just closed, if any of it ran */
+static void samplerClose(windowSampler *sampler)
+{
+    long long measured = sampler->position - (sampler->interval - sampler->window);
+    if (measured <= 0) {
+        return;
+    }
+    if (sampler->numWindows == sampler->capacity) {
+        sampler->capacity = sampler->capacity ? 2 * sampler->capacity : 64;
+        sampler->windows = realloc(sampler->windows, sampler->capacity * sizeof(sampleCounts));
+        if (!sampler->windows) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+    }
+    sampleCounts now;
+    cache_get_counts(&now);
+    sampleCounts *window = &sampler->windows[sampler->numWindows++];
+    window->accesses = now.accesses - sampler->start.accesses;
+    window->misses = now.misses - sampler->start.misses;
+    window->writebacks = now.writebacks - sampler->start.writebacks;
+}
+
+static void samplerAfter(windowSampler *sampler)
+{
+    if (++sampler->position == sampler->interval) {
+        samplerClose(sampler);
+        sampler->position = 0;
+    }
+}
+
+static void *setWorkerRun(void *arg)
+{
+    setWorker *worker = arg;
+    cacheMemory memory = flat_memory_interface(worker->memory);
+    worker->cache = cache_handle_create(worker->config, &memory);
+    cache_handle_set_output(worker->cache, outputNone);
+    if (worker->eventPath) {
+        cache_handle_log_start(worker->cache, worker->eventPath);
+    }
+    for (uint64_t i = 0; i < worker->queueLength; ++i) {
+        const traceRecord *record = &worker->queue[i];
+        long long logged = cache_handle_log_count(worker->cache);
+        enum traceKind kind = traceKindOf(record);
+        if (kind == traceRead) {
+            cache_handle_access_kind(worker->cache, traceAddr(record), accessLoad, 0);
+        } else if (kind == traceWrite) {
+            cache_handle_access_kind(worker->cache, traceAddr(record), accessStore, record->data);
+        } else {
+            cache_handle_access_kind(worker->cache, traceAddr(record), accessFetch, 0);
+        }
+        if (worker->eventPath) {
+            worker->eventCounts[i] = (unsigned char)(cache_handle_log_count(worker->cache) - logged);
+        }
+    }
+    cache_handle_log_stop(worker->cache);
+    return NULL;
+}
+
+/* The worker that simulates the set addr falls in */
+static int workerOf(const cacheConfig *config, int numWorkers, int addr)
+{
+    return (int)((long long)cache_config_set(config, addr) * numWorkers / config->numSets);
+}
+
+static int isAccess(const traceRecord *record)
+{
+    enum traceKind kind = traceKindOf(record);
+    return kind == traceRead || kind == traceWrite || kind == traceFetch;
+}
+
+/*
+ * Interleave the workers' event logs into one at path, in the order of the
+ * accesses in the trace that caused them, and remove them.
+ */
+static void mergeEventLogs(const char *path, const traceFile *trace, const cacheConfig *config,
+    setWorker *workers, int numWorkers)
+{
+    FILE *out = fopen(path, "wb");
+    FILE **parts = malloc(numWorkers * sizeof(FILE *));
+    uint64_t *next = calloc(numWorkers, sizeof(uint64_t));
+    if (!out || !parts || !next) {
+        printf("error: can't write event log %s\n", path);
+        exit(1);
+    }
+    eventHeader header;
+    for (int i = 0; i < numWorkers; ++i) {
+        parts[i] = fopen(workers[i].eventPath, "rb");
+        if (!parts[i] || fread(&header, sizeof(header), 1, parts[i]) != 1) {
+            printf("error: can't read event log %s\n", workers[i].eventPath);
+            exit(1);
+        }
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    for (uint64_t i = 0; i < trace->numRecords; ++i) {
+        const traceRecord *record = &trace->records[i];
+        if (!isAccess(record)) {
+            continue;
+        }
+        int worker = workerOf(config, numWorkers, traceAddr(record));
+        for (int n = workers[worker].eventCounts[next[worker]++]; n > 0; --n) {
+            eventRecord event;
+            if (fread(&event, sizeof(event), 1, parts[worker]) != 1) {
+                printf("error: event log %s is short\n", workers[worker].eventPath);
+                exit(1);
+            }
+            fwrite(&event, sizeof(event), 1, out);
+        }
+    }
+    for (int i = 0; i < numWorkers; ++i) {
+        fclose(parts[i]);
+        remove(workers[i].eventPath);
+    }
+    fclose(out);
+    free(parts);
+    free(next);
+}
+
+/*
+ * Replay trace through one cache of config, a range of its sets on each of
+ * up to jobs threads, then print what replaying it whole would have.
+ */
+static void replayBySets(const cacheConfig *config, const traceFile *trace, int jobs,
+    const char *eventPath)
+{
+    const char *error = cache_config_error(config);
+    if (!error) {
+        error = cache_config_set_parallel_error(config);
+    }
+    if (error) {
+        printf("error: %s\n", error);
+        exit(1);
+    }
+    cache_config_print(config);
+    int numWorkers = jobs < config->numSets ? jobs : config->numSets;
+    setWorker *workers = calloc(numWorkers, sizeof(setWorker));
+    pthread_t *threads = malloc(numWorkers * sizeof(pthread_t));
+    if (!workers || !threads) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+
+    // split the trace into a queue per worker
+    for (uint64_t i = 0; i < trace->numRecords; ++i) {
+        if (isAccess(&trace->records[i])) {
+            ++workers[workerOf(config, numWorkers, traceAddr(&trace->records[i]))].queueLength;
+        }
+    }
+    int blockSize = config->blockSize;
+    flatMemory *memory = flat_memory_create(
+        (int)(trace->header.maxAddr / blockSize + 1) * blockSize);
+    for (int i = 0; i < numWorkers; ++i) {
+        setWorker *worker = &workers[i];
+        worker->config = config;
+        worker->queue = malloc((worker->queueLength + 1) * sizeof(traceRecord));
+        worker->memory = flat_memory_share(memory);
+        if (eventPath) {
+            worker->eventPath = malloc(strlen(eventPath) + 32);
+            worker->eventCounts = malloc(worker->queueLength + 1);
+            if (!worker->eventPath || !worker->eventCounts) {
+                printf("error: out of memory\n");
+                exit(1);
+            }
+            sprintf(worker->eventPath, "%s.part%d", eventPath, i);
+        }
+        if (!worker->queue) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        worker->queueLength = 0;
+    }
+    for (uint64_t i = 0; i < trace->numRecords; ++i) {
+        const traceRecord *record = &trace->records[i];
+        if (isAccess(record)) {
+            setWorker *worker = &workers[workerOf(config, numWorkers, traceAddr(record))];
+            worker->queue[worker->queueLength++] = *record;
+        }
+    }
+
+    double start = now();
+    for (int i = 0; i < numWorkers; ++i) {
+        if (pthread_create(&threads[i], NULL, setWorkerRun, &workers[i])) {
+            printf("error: can't start a replay worker\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < numWorkers; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now() - start;
+
+    if (eventPath) {
+        mergeEventLogs(eventPath, trace, config, workers, numWorkers);
+    }
+    cacheStats total;
+    memset(&total, 0, sizeof(total));
+    long long memoryAccesses = 0;
+    uint64_t numAccesses = 0;
+    for (int i = 0; i < numWorkers; ++i) {
+        cacheStats stats;
+        cache_handle_stats(workers[i].cache, &stats);
+        cache_stats_add(&total, &stats);
+        memoryAccesses += flat_memory_accesses(workers[i].memory);
+        numAccesses += workers[i].queueLength;
+    }
+    printf("$$$ Main memory words accessed: %lld\n", memoryAccesses);
+    cache_handle_print_stats_from(workers[0].cache, &total);
+    // each worker's cache only sees its own sets
+    cacheProfileFile *profile = cache_profile_open(NULL);
+    for (int i = 0; i < numWorkers; ++i) {
+        char name[32];
+        sprintf(name, "L1 worker %d", i);
+        cache_handle_profile_write(profile, workers[i].cache, name);
+    }
+    cache_profile_close(profile);
+
+    // keep stdout diffable; timing goes to stderr
+    fprintf(stderr, "replayed %llu accesses on %d threads in %.3f s (%.1f M accesses/s)\n",
+        (unsigned long long)numAccesses, numWorkers, elapsed,
+        elapsed > 0 ? numAccesses / elapsed / 1e6 : 0.0);
+
+    for (int i = 0; i < numWorkers; ++i) {
+        cache_handle_destroy(workers[i].cache);
+        flat_memory_destroy(workers[i].memory);
+        free(workers[i].queue);
+        free(workers[i].eventPath);
+        free(workers[i].eventCounts);
+    }
+    flat_memory_destroy(memory);
+    free(workers);
+    free(threads);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5) {
+        usage(argv[0]);
+    }
+    cacheConfig config;
+    cache_config_init(&config, atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+    cache_config_from_env(&config);
+    int quiet = 0;
+    const char *eventPath = NULL;
+    // the shapes of the extra caches; their settings are L1's, once known
+    cacheConfig l1i;
+    cacheConfig lower[MAX_CACHE_LEVELS - 1];
+    int splitL1 = 0;
+    int numLower = 0;
+    enum inclusionPolicy inclusion = inclusionNone;
+    int inclusionSet = 0;
+    int jobs = 1;
+    const char *restorePath = NULL;
+    const char *checkpointPath = NULL;
+    windowSampler sampler;
+    windowSampler *sampling = NULL;
+    for (int i = 5; i < argc; ++i) {
+        if (!strcmp(argv[i], "-q")) {
+            quiet = 1;
+        } else if (!strcmp(argv[i], "-s")) {
+            config.classifyMisses = 1;
+        } else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            eventPath = argv[++i];
+        } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            if (!cache_policy_from_name(argv[++i], &config.policy)) {
+                printf("error: unknown replacement policy %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            if (!cache_prefetch_parse(argv[++i], &config)) {
+                printf("error: unknown prefetcher %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            if (!cache_write_parse(argv[++i], &config)) {
+                printf("error: unknown write settings %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+            config.victimEntries = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            if (!cache_timing_parse(argv[++i], &config)) {
+                usage(argv[0]);
+            }
+        } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            if (!cache_config_parse(argv[++i], &l1i)) {
+                usage(argv[0]);
+            }
+            splitL1 = 1;
+        } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            if (numLower == MAX_CACHE_LEVELS - 1 || !cache_config_parse(argv[++i], &lower[numLower])) {
+                usage(argv[0]);
+            }
+            ++numLower;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            if (!cache_inclusion_from_name(argv[++i], &inclusion)) {
+                printf("error: unknown inclusion policy %s\n", argv[i]);
+                exit(1);
+            }
+            inclusionSet = 1;
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+            if (jobs < 1) {
+                usage(argv[0]);
+            }
+        } else if (!strcmp(argv[i], "-S") && i + 1 < argc) {
+            config.sampleInterval = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            config.reuseWindow = atoi(argv[++i]);
+            if (config.reuseWindow < 1) {
+                usage(argv[0]);
+            }
+        } else if (!strcmp(argv[i], "-R") && i + 1 < argc) {
+            restorePath = argv[++i];
+        } else if (!strcmp(argv[i], "-C") && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        } else if (!strcmp(argv[i], "-F") && i + 1 < argc) {
+            memset(&sampler, 0, sizeof(sampler));
+            char extra;
+            if (sscanf(argv[++i], "%lld:%lld%c", &sampler.interval, &sampler.window,
+                    &extra) != 2 || sampler.window < 1 || sampler.interval < sampler.window) {
+                usage(argv[0]);
+            }
+            sampling = &sampler;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    traceFile trace;
+    traceOpen(argv[1], &trace);
+
+    // the environment can add levels too, as with the simulator
+    hierarchyConfig hierarchy;
+    cache_hierarchy_config_init(&hierarchy, &config);
+    cache_hierarchy_config_from_env(&hierarchy);
+    if (splitL1) {
+        hierarchy.splitL1 = 1;
+        hierarchy.l1i = withShape(&config, &l1i);
+    }
+    for (int i = 0; i < numLower; ++i) {
+        // only L1 prefetches, has a victim cache, models time or profiles reuse
+        hierarchy.levels[1 + i] = withShape(&config, &lower[i]);
+        hierarchy.levels[1 + i].prefetcher = prefetchNone;
+        hierarchy.levels[1 + i].victimEntries = 0;
+        hierarchy.levels[1 + i].timing = 0;
+        hierarchy.levels[1 + i].reuseWindow = 0;
+        hierarchy.numLevels = 2 + i;
+    }
+    if (inclusionSet) {
+        hierarchy.inclusion = inclusion;
+    }
+    // room for every line the trace touches, in the cache with the longest lines
+    int blockSize = hierarchy.splitL1 ? hierarchy.l1i.blockSize : 0;
+    for (int i = 0; i < hierarchy.numLevels; ++i) {
+        if (hierarchy.levels[i].blockSize > blockSize) {
+            blockSize = hierarchy.levels[i].blockSize;
+        }
+    }
+    if (blockSize > 0) {
+        memory_init((int)(trace.header.maxAddr / blockSize + 1) * blockSize);
+    }
+    if (jobs > 1) {
+        if (hierarchy.splitL1 || hierarchy.numLevels > 1) {
+            printf("error: -j simulates a single cache\n");
+            exit(1);
+        }
+        if (restorePath || checkpointPath) {
+            printf("error: -j can't checkpoint the cache it splits up\n");
+            exit(1);
+        }
+        if (sampling) {
+            printf("error: -j and -F can't be combined\n");
+            exit(1);
+        }
+        if (!quiet && !eventPath) {
+            printf("error: -j can't print cache actions as they happen; use -q or -e\n");
+            exit(1);
+        }
+        replayBySets(&config, &trace, jobs, eventPath);
+        traceClose(&trace);
+        return 0;
+    }
+    if (sampling) {
+        const char *error = cache_config_warming_error(&config);
+        if (!error && (hierarchy.splitL1 || hierarchy.numLevels > 1)) {
+            error = "functional warming needs a single cache";
+        }
+        if (error) {
+            printf("error: %s\n", error);
+            exit(1);
+        }
+    }
+    if (hierarchy.splitL1 || hierarchy.numLevels > 1) {
+        cache_init_hierarchy(&hierarchy);
+    } else {
+        cache_init_config(&config);
+    }
+    // move whole lines to and from the flat memory rather than word by word
+    cacheMemory memory = memory_interface();
+    cache_set_memory(&memory);
+    cache_set_output(quiet ? outputNone : outputText);
+    if (restorePath) {
+        memory_set_accesses(cache_restore(restorePath));
+    }
+    if (eventPath) {
+        cache_log_start(eventPath);
+    }
+
+    double start = now();
+    const traceRecord *records = trace.records;
+    uint64_t numAccesses = 0;
+    for (uint64_t i = 0; i < trace.numRecords; ++i) {
+        const traceRecord *record = &records[i];
+        if (sampling && isAccess(record)) {
+            samplerBefore(sampling);
+        }
+        switch (traceKindOf(record)) {
+        case traceRead:
+            cache_access_kind(traceAddr(record), accessLoad, 0);
+            ++numAccesses;
+            break;
+        case traceWrite:
+            cache_access_kind(traceAddr(record), accessStore, record->data);
+            ++numAccesses;
+            break;
+        case traceFetch:
+            cache_access_kind(traceAddr(record), accessFetch, 0);
+            ++numAccesses;
+            break;
+        default:
+            // captured memory traffic belongs to the capturing configuration
+            break;
+        }
+        if (sampling && isAccess(record)) {
+            samplerAfter(sampling);
+        }
+    }
+    if (sampling) {
+        samplerClose(sampling);
+        cache_set_warming(0);
+    }
+    double elapsed = now() - start;
+    if (checkpointPath) {
+        cache_checkpoint(checkpointPath, memory_accesses());
+    }
+
+    printf("$$$ Main memory words accessed: %lld\n", memory_accesses());
+    printStats();
+    if (sampling) {
+        long long measured = 0;
+        for (int i = 0; i < sampling->numWindows; ++i) {
+            measured += sampling->windows[i].accesses;
+        }
+        printf("measured %lld of %llu accesses, in %d windows of %lld every %lld\n", measured,
+            (unsigned long long)numAccesses, sampling->numWindows, sampling->window,
+            sampling->interval);
+        cache_print_estimates(sampling->windows, sampling->numWindows,
+            numAccesses ? (double)measured / numAccesses : 1.0, (long long)numAccesses,
+            "the whole trace");
+        free(sampling->windows);
+    }
+
+    // keep stdout diffable; timing goes to stderr
+    fprintf(stderr, "replayed %llu accesses in %.3f s (%.1f M accesses/s)\n",
+        (unsigned long long)numAccesses, elapsed,
+        elapsed > 0 ? numAccesses / elapsed / 1e6 : 0.0);
+
+    traceClose(&trace);
+    return 0;
+}
@@ -0,0 +1,478 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Configuration sweep: replay one trace against every combination of
+ * line size, number of sets, lines per set and replacement policy, in
+ * parallel.
+ *
+ * Each worker thread takes the next configuration, builds its own cache
+ * instance and memory for it, and replays the one shared, read-only trace.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "memory.h"
+#include "trace.h"
+
+#define MAX_SWEEP_VALUES 64
+
+typedef struct sweepResult
+{
+    int blockSize;
+    int numSets;
+    int blocksPerSet;
+    enum replacementPolicy policy;
+    cacheConfig prefetch; // only the prefetcher and its degree
+    cacheConfig write;    // only the write settings
+    int victimEntries;
+    cacheConfig timing;   // only the timing settings
+    int classifyMisses;
+    const char *error; // why the cache rejected the config, or NULL
+    cacheStats stats;
+} sweepResult;
+
+/* Shared by all the workers */
+typedef struct sweepState
+{
+    const traceFile *trace;
+    sweepResult *results;
+    int numConfigs;
+    int next; // the next config to run, under lock
+    cacheProfileFile *profile; // written under lock
+    pthread_mutex_t lock;
+} sweepState;
+
+static void usage(const char *program)
+{
+    printf("error: usage: %s <trace file> <line sizes> <set counts> <lines per set> "
+        "[-p policies] [-f prefetchers] [-w writes] [-v victim lines] [-t timings]\n"
+        "\t[-j jobs] [-c]\n",
+        program);
+    printf("\teach list is comma separated, e.g. %s prog.trace 1,2,4 1,4,16 1,2 -p lru,fifo\n",
+        program);
+    printf("\t-f takes prefetchers like -p takes policies, e.g. none,next-line:2,stream\n");
+    printf("\t-w takes write settings, e.g. write-back,write-through+buffer:8,"
+        "write-back+no-allocate\n");
+    printf("\t-v takes victim cache sizes, e.g. 0,4,8\n");
+    printf("\t-t takes <hit latency>:<miss penalty>:<words per cycle>[:<MSHRs>], e.g. "
+        "1:100:1,1:100:1:8\n");
+    printf("\t-c adds columns that classify misses as compulsory, capacity or conflict\n");
+    exit(1);
+}
+
+/*
+ * Parse a comma separated list of numbers, none below minimum, into
+ * values. Returns how many there were.
+ */
+static int parseList(const char *list, int *values, int minimum, const char *program)
+{
+    int count = 0;
+    const char *next = list;
+    while (*next) {
+        char *end;
+        long value = strtol(next, &end, 10);
+        if (end == next || value < minimum || count == MAX_SWEEP_VALUES) {
+            usage(program);
+        }
+        values[count++] = (int)value;
+        next = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            usage(program);
+        }
+    }
+    if (count == 0) {
+        usage(program);
+    }
+    return count;
+}
+
+/*
+ * Parse a comma separated list of policy names into policies.
+ * Returns how many there were.
+ */
+static int parsePolicies(char *list, enum replacementPolicy *policies, const char *program)
+{
+    int count = 0;
+    for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        if (count == MAX_SWEEP_VALUES || !cache_policy_from_name(name, &policies[count])) {
+            usage(program);
+        }
+        ++count;
+    }
+    if (count == 0) {
+        usage(program);
+    }
+    return count;
+}
+
+/*
+ * Parse a comma separated list of prefetchers, each <name>[:<degree>],
+ * into the prefetch settings of configs. Returns how many there were.
+ */
+static int parsePrefetchers(char *list, cacheConfig *configs, const char *program)
+{
+    int count = 0;
+    for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        if (count == MAX_SWEEP_VALUES) {
+            usage(program);
+        }
+        cache_config_init(&configs[count], 1, 1, 1);
+        if (!cache_prefetch_parse(name, &configs[count])) {
+            usage(program);
+        }
+        ++count;
+    }
+    if (count == 0) {
+        usage(program);
+    }
+    return count;
+}
+
+/*
+ * Parse a comma separated list of write settings (see cache_write_parse)
+ * into the write settings of configs. Returns how many there were.
+ */
+static int parseWrites(char *list, cacheConfig *configs, const char *program)
+{
+    int count = 0;
+    for (char *text = strtok(list, ","); text; text = strtok(NULL, ",")) {
+        if (count == MAX_SWEEP_VALUES) {
+            usage(program);
+        }
+        cache_config_init(&configs[count], 1, 1, 1);
+        if (!cache_write_parse(text, &configs[count])) {
+            usage(program);
+        }
+        ++count;
+    }
+    if (count == 0) {
+        usage(program);
+    }
+    return count;
+}
+
+/*
+ * Parse a comma separated list of timings (see cache_timing_parse) into
+ * the timing settings of configs. Returns how many there were.
+ */
+static int parseTimings(char *list, cacheConfig *configs, const char *program)
+{
+    int count = 0;
+    for (char *text = strtok(list, ","); text; text = strtok(NULL, ",")) {
+        if (count == MAX_SWEEP_VALUES) {
+            usage(program);
+        }
+        cache_config_init(&configs[count], 1, 1, 1);
+        if (!cache_timing_parse(text, &configs[count])) {
+            usage(program);
+        }
+        ++count;
+    }
+    if (count == 0) {
+        usage(program);
+    }
+    return count;
+}
+
+static void runConfig(sweepState *state, int index)
+{
+    const traceFile *trace = state->trace;
+    sweepResult *result = &state->results[index];
+    cacheConfig config;
+    cache_config_init(&config, result->blockSize, result->numSets, result->blocksPerSet);
+    config.policy = result->policy;
+    config.classifyMisses = result->classifyMisses;
+    config.prefetcher = result->prefetch.prefetcher;
+    config.prefetchDegree = result->prefetch.prefetchDegree;
+    config.writePolicy = result->write.writePolicy;
+    config.writeAllocate = result->write.writeAllocate;
+    config.writeBufferEntries = result->write.writeBufferEntries;
+    config.victimEntries = result->victimEntries;
+    config.timing = result->timing.timing;
+    config.hitLatency = result->timing.hitLatency;
+    config.missPenalty = result->timing.missPenalty;
+    config.memoryBandwidth = result->timing.memoryBandwidth;
+    config.mshrs = result->timing.mshrs;
+    result->error = cache_config_error(&config);
+    if (result->error) {
+        return;
+    }
+
+    flatMemory *memory = flat_memory_create(
+        (int)(trace->header.maxAddr / config.blockSize + 1) * config.blockSize);
+    cacheMemory memoryInterface = flat_memory_interface(memory);
+    cacheStruct *cache = cache_handle_create(&config, &memoryInterface);
+    cache_handle_set_output(cache, outputNone);
+
+    for (uint64_t i = 0; i < trace->numRecords; ++i) {
+        const traceRecord *record = &trace->records[i];
+        enum traceKind kind = traceKindOf(record);
+        if (kind == traceRead) {
+            cache_handle_access_kind(cache, traceAddr(record), accessLoad, 0);
+        } else if (kind == traceWrite) {
+            cache_handle_access_kind(cache, traceAddr(record), accessStore, record->data);
+        } else if (kind == traceFetch) {
+            cache_handle_access_kind(cache, traceAddr(record), accessFetch, 0);
+        }
+    }
+
+    cache_handle_stats(cache, &result->stats);
+    if (state->profile) {
+        // named after its row of the table
+        char name[64];
+        snprintf(name, sizeof(name), "config %d: %d,%d,%d %s", index + 1, result->blockSize,
+            result->numSets, result->blocksPerSet, cache_policy_name(result->policy));
+        pthread_mutex_lock(&state->lock);
+        cache_handle_profile_write(state->profile, cache, name);
+        pthread_mutex_unlock(&state->lock);
+    }
+    cache_handle_destroy(cache);
+    flat_memory_destroy(memory);
+}
+
+static void *worker(void *arg)
+{
+    sweepState *state = arg;
+    for (;;) {
+        pthread_mutex_lock(&state->lock);
+        int config = state->next++;
+        pthread_mutex_unlock(&state->lock);
+        if (config >= state->numConfigs) {
+            return NULL;
+        }
+        runConfig(state, config);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5) {
+        usage(argv[0]);
+    }
+    int blockSizes[MAX_SWEEP_VALUES];
+    int setCounts[MAX_SWEEP_VALUES];
+    int ways[MAX_SWEEP_VALUES];
+    enum replacementPolicy policies[MAX_SWEEP_VALUES] = { policyLRU };
+    int numBlockSizes = parseList(argv[2], blockSizes, 1, argv[0]);
+    int numSetCounts = parseList(argv[3], setCounts, 1, argv[0]);
+    int numWays = parseList(argv[4], ways, 1, argv[0]);
+    int numPolicies = 1;
+    int classifyMisses = 0;
+    cacheConfig prefetchers[MAX_SWEEP_VALUES];
+    cache_config_init(&prefetchers[0], 1, 1, 1);
+    int numPrefetchers = 1;
+    int showPrefetch = 0;
+    cacheConfig writes[MAX_SWEEP_VALUES];
+    cache_config_init(&writes[0], 1, 1, 1);
+    int numWrites = 1;
+    int showWrites = 0;
+    int victimSizes[MAX_SWEEP_VALUES] = { 0 };
+    int numVictimSizes = 1;
+    int showVictims = 0;
+    cacheConfig timings[MAX_SWEEP_VALUES];
+    cache_config_init(&timings[0], 1, 1, 1);
+    int numTimings = 1;
+    int showTimings = 0;
+
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 5; i < argc; ++i) {
+        if (!strcmp(argv[i], "-c")) {
+            classifyMisses = 1;
+            continue;
+        }
+        if (i + 1 == argc) {
+            usage(argv[0]);
+        }
+        if (!strcmp(argv[i], "-j")) {
+            jobs = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-p")) {
+            numPolicies = parsePolicies(argv[++i], policies, argv[0]);
+        } else if (!strcmp(argv[i], "-f")) {
+            numPrefetchers = parsePrefetchers(argv[++i], prefetchers, argv[0]);
+            showPrefetch = 1;
+        } else if (!strcmp(argv[i], "-w")) {
+            numWrites = parseWrites(argv[++i], writes, argv[0]);
+            showWrites = 1;
+        } else if (!strcmp(argv[i], "-v")) {
+            numVictimSizes = parseList(argv[++i], victimSizes, 0, argv[0]);
+            showVictims = 1;
+        } else if (!strcmp(argv[i], "-t")) {
+            numTimings = parseTimings(argv[++i], timings, argv[0]);
+            showTimings = 1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+
+    traceFile trace;
+    traceOpen(argv[1], &trace);
+
+    int numConfigs = numBlockSizes * numSetCounts * numWays * numPolicies * numPrefetchers
+        * numWrites * numVictimSizes * numTimings;
+    sweepResult *results = calloc(numConfigs, sizeof(sweepResult));
+    if (!results) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    int next = 0;
+    for (int b = 0; b < numBlockSizes; ++b) {
+        for (int s = 0; s < numSetCounts; ++s) {
+            for (int w = 0; w < numWays; ++w) {
+                for (int p = 0; p < numPolicies; ++p) {
+                    for (int f = 0; f < numPrefetchers; ++f) {
+                        for (int m = 0; m < numWrites; ++m) {
+                            for (int v = 0; v < numVictimSizes; ++v) {
+                                for (int t = 0; t < numTimings; ++t) {
+                                    sweepResult *result = &results[next++];
+                                    result->blockSize = blockSizes[b];
+                                    result->numSets = setCounts[s];
+                                    result->blocksPerSet = ways[w];
+                                    result->policy = policies[p];
+                                    result->prefetch = prefetchers[f];
+                                    result->write = writes[m];
+                                    result->victimEntries = victimSizes[v];
+                                    result->timing = timings[t];
+                                    result->classifyMisses = classifyMisses;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    sweepState state;
+    state.trace = &trace;
+    state.results = results;
+    state.numConfigs = numConfigs;
+    state.next = 0;
+    state.profile = cache_profile_open(NULL);
+    pthread_mutex_init(&state.lock, NULL);
+    if (jobs > numConfigs) {
+        jobs = numConfigs;
+    }
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    if (!threads) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    for (long i = 0; i < jobs; ++i) {
+        if (pthread_create(&threads[i], NULL, worker, &state)) {
+            printf("error: can't start a sweep worker\n");
+            exit(1);
+        }
+    }
+    for (long i = 0; i < jobs; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&state.lock);
+    cache_profile_close(state.profile);
+    free(threads);
+
+    printf("line size\tsets\tlines per set\tpolicy\t");
+    if (showPrefetch) {
+        printf("prefetcher\t");
+    }
+    if (showWrites) {
+        printf("writes\t");
+    }
+    if (showVictims) {
+        printf("victim lines\t");
+    }
+    if (showTimings) {
+        printf("timing\t");
+    }
+    printf("hits\tmisses\twritebacks\tmemory words");
+    if (showPrefetch) {
+        printf("\tprefetch accuracy\tprefetch coverage\tprefetch words");
+    }
+    if (showWrites) {
+        printf("\twords read\twords written\tstores below\tcoalesced");
+    }
+    if (showVictims) {
+        printf("\tvictim hits\tvictim writebacks");
+    }
+    if (showTimings) {
+        printf("\tcycles\tAMAT\tmerged misses");
+    }
+    if (classifyMisses) {
+        printf("\tcompulsory\tcapacity\tconflict");
+    }
+    printf("\n");
+    for (int i = 0; i < numConfigs; ++i) {
+        const sweepResult *result = &results[i];
+        printf("%d\t%d\t%d\t%s\t", result->blockSize, result->numSets, result->blocksPerSet,
+            cache_policy_name(result->policy));
+        if (showPrefetch) {
+            printf("%s:%d\t", cache_prefetcher_name(result->prefetch.prefetcher),
+                result->prefetch.prefetchDegree);
+        }
+        if (showWrites) {
+            char writeText[64];
+            cache_write_format(&result->write, writeText, sizeof(writeText));
+            printf("%s\t", writeText);
+        }
+        if (showVictims) {
+            printf("%d\t", result->victimEntries);
+        }
+        if (showTimings) {
+            const cacheConfig *timing = &result->timing;
+            printf("%d:%d:%d", timing->hitLatency, timing->missPenalty, timing->memoryBandwidth);
+            if (timing->mshrs) {
+                printf(":%d", timing->mshrs);
+            }
+            printf("\t");
+        }
+        if (result->error) {
+            printf("%s\n", result->error);
+        } else {
+            // with a victim cache, it's the one that talks to memory
+            printf("%lld\t%lld\t%lld\t%lld", result->stats.hits, result->stats.misses,
+                result->stats.writebacks,
+                result->victimEntries ? result->stats.victimMemWords : result->stats.memWords);
+            if (showPrefetch) {
+                const cacheStats *stats = &result->stats;
+                long long uncovered = stats->misses - stats->bufferHits;
+                long long demand = stats->usefulPrefetches + uncovered;
+                printf("\t%.3f\t%.3f\t%lld",
+                    stats->prefetches ? (double)stats->usefulPrefetches / stats->prefetches : 0.0,
+                    demand ? (double)stats->usefulPrefetches / demand : 0.0,
+                    stats->prefetchWords);
+            }
+            if (showWrites) {
+                printf("\t%lld\t%lld\t%lld\t%lld", result->stats.memReadWords,
+                    result->stats.memWriteWords, result->stats.storesBelow,
+                    result->stats.coalescedStores);
+            }
+            if (showVictims) {
+                printf("\t%lld\t%lld", result->stats.victimHits, result->stats.victimWritebacks);
+            }
+            if (showTimings) {
+                const cacheStats *stats = &result->stats;
+                long long accesses = stats->hits + stats->misses;
+                printf("\t%lld\t%.2f\t%lld", stats->cycles,
+                    accesses ? (double)stats->accessCycles / accesses : 0.0, stats->mergedMisses);
+            }
+            if (classifyMisses) {
+                printf("\t%lld\t%lld\t%lld", result->stats.compulsoryMisses,
+                    result->stats.capacityMisses, result->stats.conflictMisses);
+            }
+            printf("\n");
+        }
+    }
+
+    free(results);
+    traceClose(&trace);
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Reading binary address traces (see trace.h).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#ifdef _WIN32
+#define TRACE_NO_MMAP
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Map the whole file read-only. Falls back to reading it into the heap
+ * where mmap isn't available.
+ */
+static void mapFile(const char *path, traceFile *trace)
+{
+#ifdef TRACE_NO_MMAP
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("error: can't open trace file %s\n", path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    trace->mapSize = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    trace->map = malloc(trace->mapSize ? trace->mapSize : 1);
+    if (!trace->map || fread(trace->map, 1, trace->mapSize, file) != trace->mapSize) {
+        printf("error: can't read trace file %s\n", path);
+        exit(1);
+    }
+    fclose(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("error: can't open trace file %s\n", path);
+        exit(1);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        printf("error: can't stat trace file %s\n", path);
+        exit(1);
+    }
+    trace->mapSize = (size_t)info.st_size;
+    if (trace->mapSize < sizeof(traceHeader)) {
+        printf("error: %s is too short to be a trace file\n", path);
+        exit(1);
+    }
+    trace->map = mmap(NULL, trace->mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED) {
+        printf("error: can't map trace file %s\n", path);
+        exit(1);
+    }
+    // we stream through the records once, front to back
+    posix_madvise(trace->map, trace->mapSize, POSIX_MADV_SEQUENTIAL);
+    close(fd);
+#endif
+}
+
+/*
+ * Open a trace file and check its header. Exits on any error, like the
+ * rest of the simulator.
+ */
+void traceOpen(const char *path, traceFile *trace)
+{
+    mapFile(path, trace);
+    if (trace->mapSize < sizeof(traceHeader)) {
+        printf("error: %s is too short to be a trace file\n", path);
+        exit(1);
+    }
+    memcpy(&trace->header, trace->map, sizeof(traceHeader));
+
+    if (memcmp(trace->header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        printf("error: %s is not a trace file\n", path);
+        exit(1);
+    }
+    if (trace->header.version < 1 || trace->header.version > TRACE_VERSION) {
+        printf("error: %s has unsupported trace version %u\n", path,
+            (unsigned)trace->header.version);
+        exit(1);
+    }
+    if (trace->header.recordSize != sizeof(traceRecord)) {
+        printf("error: %s has %u byte records, expected %u\n", path,
+            (unsigned)trace->header.recordSize, (unsigned)sizeof(traceRecord));
+        exit(1);
+    }
+
+    // trust the file size over the header in case the writer didn't finish
+    uint64_t available = (trace->mapSize - sizeof(traceHeader)) / sizeof(traceRecord);
+    trace->numRecords = trace->header.numRecords;
+    if (trace->numRecords > available) {
+        printf("warning: %s is truncated; replaying %llu of %llu records\n", path,
+            (unsigned long long)available, (unsigned long long)trace->numRecords);
+        trace->numRecords = available;
+    }
+    trace->records = (const traceRecord *)((const char *)trace->map + sizeof(traceHeader));
+}
+
+void traceClose(traceFile *trace)
+{
+#ifdef TRACE_NO_MMAP
+    free(trace->map);
+#else
+    munmap(trace->map, trace->mapSize);
+#endif
+    trace->map = NULL;
+    trace->records = NULL;
+    trace->numRecords = 0;
+}
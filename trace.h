@@ -0,0 +1,82 @@
+/*
+ * EECS 370, University of Michigan
+ * Project 4: LC-2K Cache Simulator
+ * Binary address trace format.
+ *
+ * A trace file is a traceHeader followed by header.numRecords traceRecords,
+ * all little-endian. Each traceRead/traceWrite/traceFetch record is one
+ * cache_access call. Captured traces (version 2) also follow each access
+ * with the mem_access calls it caused, as traceMemRead/traceMemWrite
+ * records. Version 3 tells instruction fetches (traceFetch) from lw
+ * (traceRead); older traces have only traceRead.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "C370TRC"
+#define TRACE_VERSION 3
+
+// The low 28 bits of a record's info word hold the word address
+#define TRACE_ADDR_BITS 28
+#define TRACE_ADDR_MASK ((1u << TRACE_ADDR_BITS) - 1)
+
+enum traceKind
+{
+    traceRead = 0,    // cache_access(addr, 0, 0)
+    traceWrite = 1,   // cache_access(addr, 1, data)
+    traceMemRead = 2, // mem_access(addr, 0, 0) returned data (version 2)
+    traceMemWrite = 3, // mem_access(addr, 1, data) (version 2)
+    traceFetch = 4     // cache_access(addr, 0, 0) fetching an instruction (version 3)
+};
+
+typedef struct traceHeader
+{
+    char magic[8];       // TRACE_MAGIC, NUL terminated
+    uint32_t version;    // TRACE_VERSION of the writer
+    uint32_t recordSize; // sizeof(traceRecord)
+    uint64_t numRecords;
+    uint32_t maxAddr;    // largest word address in the trace
+    uint32_t reserved;
+} traceHeader;
+
+typedef struct traceRecord
+{
+    uint32_t info; // kind in the top 4 bits, word address in the rest
+    int32_t data;  // only meaningful for writes
+} traceRecord;
+
+static inline int traceAddr(const traceRecord *record)
+{
+    return (int)(record->info & TRACE_ADDR_MASK);
+}
+
+static inline enum traceKind traceKindOf(const traceRecord *record)
+{
+    return (enum traceKind)(record->info >> TRACE_ADDR_BITS);
+}
+
+static inline traceRecord makeTraceRecord(enum traceKind kind, int addr, int data)
+{
+    traceRecord record;
+    record.info = ((uint32_t)kind << TRACE_ADDR_BITS) | ((uint32_t)addr & TRACE_ADDR_MASK);
+    record.data = data;
+    return record;
+}
+
+/* A trace mapped into memory by traceOpen (trace.c) */
+typedef struct traceFile
+{
+    traceHeader header;
+    const traceRecord *records;
+    uint64_t numRecords;
+    void *map;      // the whole mapped file
+    size_t mapSize;
+} traceFile;
+
+void traceOpen(const char *path, traceFile *trace);
+void traceClose(traceFile *trace);
+
+#endif